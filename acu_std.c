@@ -1,7 +1,10 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <errno.h>
 #ifdef ACU_THREAD_SAFE
 	#include <pthread.h>
@@ -13,46 +16,164 @@
 #include "autocleanup.h"
 #include "acu_std.h"
 
-void *acu_malloc(size_t s)
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+	#define _ACU_CLOSE_RANGE
+#endif
+
+/* Scoped bump arenas. An arena is the current one of the thread from acu_arena() until it's released, and it
+ * serves the allocations made at the scope depth it was opened at; allocations made in deeper scopes, which
+ * expect to be released earlier, go to the heap as usual. Small allocations are carved from chunks of the
+ * requested size, larger ones get a chunk of their own. */
+#define _ACU_ARENA_CHUNK 16384
+#define _ACU_ARENA_ALIGN 16
+#define _ACU_ARENA_ROUND(n) (((n) + _ACU_ARENA_ALIGN - 1) & ~(size_t)(_ACU_ARENA_ALIGN - 1))
+
+struct _acu_arena_chunk {
+	struct _acu_arena_chunk *next;
+};
+#define _ACU_ARENA_HDR _ACU_ARENA_ROUND(sizeof(struct _acu_arena_chunk))
+
+struct _acu_arena {
+	struct _acu_arena *prev;		/* arena that was current when this one was opened */
+	struct _acu_arena_chunk *chunks;
+	char *cur, *end;
+	size_t chunk;
+	long scope;
+};
+
+static __thread struct _acu_arena *_acu_arena_cur = NULL;
+
+/* The current arena if it serves the current scope depth, otherwise NULL */
+#define _ACU_ARENA() (_acu_arena_cur && _acu_arena_cur->scope == _acu_scope ? _acu_arena_cur : NULL)
+
+static void _acu_arena_release(void *p)
+{
+	struct _acu_arena *a = p, **pp;
+	struct _acu_arena_chunk *c, *next;
+
+	for (pp = &_acu_arena_cur; *pp; pp = &((*pp)->prev)) if (*pp == a)
+	{
+		*pp = a->prev;
+		break;
+	}
+	for (c = a->chunks; c; c = next)
+	{
+		next = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/* Allocate s bytes from arena a, return NULL if out of memory. There's no unique node for the memory, so make
+ * acu_latest() throw instead of returning some earlier node. */
+static void *_acu_arena_alloc(struct _acu_arena *a, size_t s)
 {
-	void *p = malloc(s);
-	if (p) (void)acu_new_unique(p, free);
+	char *p;
+
+	_acu_latest = NULL;
+	s = _ACU_ARENA_ROUND(s ? s : 1);
+	if (s > (size_t)(a->end - a->cur))
+	{
+		size_t n = s > a->chunk / 4 ? s : a->chunk;
+		struct _acu_arena_chunk *c = malloc(_ACU_ARENA_HDR + n);
+		if (c == NULL) return NULL;
+		c->next = a->chunks;
+		a->chunks = c;
+		p = (char *)c + _ACU_ARENA_HDR;
+		if (n != a->chunk) return p;
+		a->cur = p;
+		a->end = p + n;
+	}
+	p = a->cur;
+	a->cur += s;
 	return p;
 }
 
+acu_unique *acu_arena(size_t chunk)
+{
+	struct _acu_arena *a = malloc(sizeof(struct _acu_arena));
+	acu_unique *u;
+	if (a == NULL) return NULL;
+	a->chunks = NULL;
+	a->cur = a->end = NULL;
+	a->chunk = _ACU_ARENA_ROUND(chunk ? chunk : _ACU_ARENA_CHUNK);
+	a->scope = _acu_scope;
+	u = acu_new_unique(a, _acu_arena_release);
+	_acu_bind_thread(u);
+	a->prev = _acu_arena_cur;
+	_acu_arena_cur = a;
+	return u;
+}
+
+acu_unique *acu_arena_t(size_t chunk)
+{
+	acu_unique *u = acu_arena(chunk);
+	if (u == NULL) throw(new_mem_exception("acu_arena_t", sizeof(struct _acu_arena)));
+	return u;
+}
+
+/* Allocate 's' bytes from the heap, zeroed if 'zero', with a unique node freeing them, return NULL if out of
+ * memory. The linked stack takes a single block with the node as its prefix; the node is moved to the slab if
+ * acu_latest() hands it out. Entries of the array stack need no allocation. */
+#ifndef ACU_ARRAY_STACK
+	static void *_acu_heap_alloc(size_t s, int zero)
+	{
+		void *b;
+		if (s > (size_t)-1 - _ACU_PREFIX) return NULL;
+		b = zero ? calloc(1, _ACU_PREFIX + s) : malloc(_ACU_PREFIX + s);
+		return b ? _acu_push_prefixed(b) : NULL;
+	}
+#else
+	static void *_acu_heap_alloc(size_t s, int zero)
+	{
+		void *p = zero ? calloc(1, s) : malloc(s);
+		if (p) (void)acu_new_unique(p, free);
+		return p;
+	}
+#endif
+
+void *acu_malloc(size_t s)
+{
+	struct _acu_arena *a = _ACU_ARENA();
+	if (a) return _acu_arena_alloc(a, s);
+	return _acu_heap_alloc(s, 0);
+}
+
 void *acu_malloc_t(size_t s)
 {
-	void *p = malloc_t(s);
-	(void)acu_new_unique(p, free);
+	void *p = acu_malloc(s);
+	if (p == NULL) throw(new_mem_exception("acu_malloc_t", s));
 	return p;
 }
 
 void *acu_calloc(size_t n, size_t s)
 {
-	void *p = calloc(n, s);
-	if (p) acu_new_unique(p, free);
+	struct _acu_arena *a = _ACU_ARENA();
+	void *p;
+	if (s && n > (size_t)-1 / s) return NULL;
+	if (a == NULL) return _acu_heap_alloc(n * s, 1);
+	if ((p = _acu_arena_alloc(a, n * s))) memset(p, 0, n * s);
 	return p;
 }
 
 void *acu_calloc_t(size_t n, size_t s)
 {
-	void *p = calloc_t(n, s);
-	acu_new_unique(p, free);
+	void *p = acu_calloc(n, s);
+	if (p == NULL) throw(new_mem_exception("acu_calloc_t", n * s));
 	return p;
 }
 
+/* Objects are left intact by a failing realloc, destruct it, as if realloc had failed with an unmanaged pointer */
 void *acu_realloc(size_t s, acu_unique *a)
 {
-	void *p = realloc(acu_get_ptr(a), s);
-	acu_update(a, p);
+	void *p = _acu_realloc(a, s);
 	if (p == NULL) acu_destruct(a);
 	return p;
 }
 
 void *acu_realloc_t(size_t s, acu_unique *a)
 {
-	void *p = realloc(acu_get_ptr(a), s);
-	acu_update(a, p);
+	void *p = _acu_realloc(a, s);
 	if (p == NULL)
 	{
 		acu_destruct(a);
@@ -63,15 +184,17 @@ void *acu_realloc_t(size_t s, acu_unique *a)
 
 char *acu_strdup(const char *s)
 {
-	char *p = strdup(s);
-	if (p) (void)acu_new_unique(p, free);
+	struct _acu_arena *a = _ACU_ARENA();
+	size_t n = strlen(s) + 1;
+	char *p = a ? _acu_arena_alloc(a, n) : _acu_heap_alloc(n, 0);
+	if (p) memcpy(p, s, n);
 	return p;
 }
 
 char *acu_strdup_t(const char *s)
 {
-	char *p = strdup_t(s);
-	(void)acu_new_unique(p, free);
+	char *p = acu_strdup(s);
+	if (p == NULL) throw(new_mem_exception("acu_strdup_t", strlen(s) + 1));
 	return p;
 }
 
@@ -94,6 +217,32 @@ static void _acu_std_close(void *fd_voidptr)
 	close((int)(long)fd_voidptr);
 }
 
+/* Bulk version of _acu_std_close, closing runs of consecutive descriptors with a single close_range call */
+static void _acu_std_close_bulk(void **fds, int n)
+{
+	int i, j;
+	for (i = 1; i < n; i++) for (j = i; j > 0 && (long)fds[j - 1] > (long)fds[j]; j--)
+	{
+		void *t = fds[j];
+		fds[j] = fds[j - 1];
+		fds[j - 1] = t;
+	}
+	for (i = 0; i < n; i = j)
+	{
+		j = i + 1;
+		while (j < n && (long)fds[j] == (long)fds[j - 1] + 1) j++;
+		#ifdef _ACU_CLOSE_RANGE
+			if (j - i > 1 && close_range((unsigned)(long)fds[i], (unsigned)(long)fds[j - 1], 0) == 0) continue;
+		#endif
+		for (; i < j; i++) close((int)(long)fds[i]);
+	}
+}
+
+int acu_register_std_bulk(void)
+{
+	return acu_register_bulk(_acu_std_close, _acu_std_close_bulk);
+}
+
 int acu_open(const char *s, int m)
 {
 	int fd = open(s, m);
@@ -108,11 +257,32 @@ int acu_open_t(const char *s, int m)
 	return fd;
 }
 
+static void _acu_std_munmap(void *p, uintptr_t len)
+{
+	(void)munmap(p, len);
+}
+
+void *acu_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	void *p = mmap(addr, len, prot, flags, fd, off);
+	if (p != MAP_FAILED) (void)acu_new_unique_arg(p, len, _acu_std_munmap);
+	return p;
+}
+
+void *acu_mmap_t(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	void *p = mmap(addr, len, prot, flags, fd, off);
+	if (p == MAP_FAILED) throw(new_io_exception(errno, "", "mmap"));
+	(void)acu_new_unique_arg(p, len, _acu_std_munmap);
+	return p;
+}
+
 #ifdef ACU_THREAD_SAFE
 	acu_unique *acu_pthread_mutex_lock(pthread_mutex_t *lock)
 	{
-		//if (pthread_mutex_lock(lock)) ; //throw(new_io_error(errno, "", "acu_pthread_mutex_lock"));
-		return acu_new_unique(lock, (void (*)(void *))pthread_mutex_unlock);	
+		int err = pthread_mutex_lock(lock);
+		if (err) throw(new_io_exception(err, "", "pthread_mutex_lock"));
+		return acu_new_unique(lock, (void (*)(void *))pthread_mutex_unlock);
 	}
 #endif
 
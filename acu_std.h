@@ -2,11 +2,22 @@
 #define ACU_STD_H
 
 #include <stdio.h>
+#include <sys/types.h>
 #ifdef ACU_THREAD_SAFE
 	#include <pthread.h>
 #endif
 #include "autocleanup.h"
 
+/* Open a bump arena for the current scope, released as a whole by the unique node returned (NULL if out of
+ * memory). Until then, acu_malloc, acu_calloc and acu_strdup and their _t variants called at the depth of this
+ * scope allocate from the arena, without a unique node of their own; consequently acu_latest() throws after them,
+ * and memory from an arena can't be destructed, yielded, transferred or shared on its own. 'chunk' is the size
+ * of the chunks obtained from the heap, 0 for a default. The arena node must not be submitted to a shared node.
+ * The arena is bound to the calling thread: deferring its node, or with ACU_THREAD_SAFE sharing or submitting
+ * it, throws a name exception. */
+acu_unique *acu_arena(size_t chunk);
+acu_unique *acu_arena_t(size_t chunk);
+
 void *acu_malloc(size_t);
 void *acu_malloc_t(size_t);
 void *acu_calloc(size_t, size_t);
@@ -24,6 +35,14 @@ FILE *acu_fopen_t(const char *, const char *);
 int acu_open(const char *, int);
 int acu_open_t(const char *, int);
 
+/* Map memory as mmap, unmapped with munmap at the end of the scope. acu_mmap returns MAP_FAILED on failure. */
+void *acu_mmap(void *, size_t, int, int, int, off_t);
+void *acu_mmap_t(void *, size_t, int, int, int, off_t);
+
+/* Register bulk destruction of descriptors opened by acu_open (see acu_register_bulk), which closes runs of
+ * consecutive descriptors with close_range where available. Return value as for acu_register_bulk. */
+int acu_register_std_bulk(void);
+
 #ifdef ACU_THREAD_SAFE
 	acu_unique *acu_pthread_mutex_lock(pthread_mutex_t *lock);
 #endif
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #ifdef ACU_THREAD_SAFE
 	#include <pthread.h>
-	#include "acu_std.h"
+	#include <semaphore.h>
+	#include <stdatomic.h>
 #endif
 #include "exception.h"
 #include "exc_classes.h"
@@ -16,97 +18,784 @@ static void _acu_del_weak_ref(void *p);
 
 /* Opaque classes */
 
-/* Base class storing reference to the actual object, and its destructor function */
-struct _acu_node {
-	void *ptr;
-	void (*del)(void *);
-};
-
 #define _ACU_TRANSFERRABLE 1
 #define _ACU_SHAREABLE 2
 #define _ACU_SUBMITTABLE 4
-/* Class for unique object references */
-struct _acu_stack_node {
+#define _ACU_OWNERSHIP (_ACU_TRANSFERRABLE | _ACU_SHAREABLE | _ACU_SUBMITTABLE)
+#define _ACU_SLAB 8		/* node memory belongs to the slab of the creating thread */
+#define _ACU_DEAD 16		/* array stack entry that has been destructed or detached */
+#define _ACU_DEFERRED 32	/* destructed by the reaper thread at cleanup, see acu_defer_destruct */
+#define _ACU_MOVED (_ACU_OWNERSHIP | _ACU_DEFERRED | _ACU_BOUND)	/* properties that follow the object when moved */
+#define _ACU_EMBEDDED 64	/* node memory is a header embedded in the object */
+#define _ACU_PREFIXED 128	/* embedded node prefixed to the block by acu_malloc, moved to the slab when handed out */
+#define _ACU_WIDE 256		/* node of the slab of wide nodes, which have room for a destructor argument */
+#define _ACU_ARG 512		/* destructor takes the argument stored with the node as its second argument */
+#define _ACU_BOUND 1024		/* destructor uses thread-local state of the creating thread, see _acu_bind_thread */
+#define _ACU_NEWER_BELOW 2048	/* array stack entry whose lower neighbour reuses a dead entry, see _acu_push */
+
+/* Class for unique object references submitted to a shared object. These are never handed out to the client. */
+struct _acu_tail_node {
 	struct _acu_node base;
-	acu_unique *next, *prev;
-	long scope;
-	int properties;
+	struct _acu_tail_node *next;
 };
 
-/* Class for shared object references */
+/* Class for shared object references. The strong count is in the low half of the counts, and the weak count in the
+ * high half, so that every transition of the two is a single update. The strong references together hold one weak
+ * count, which is dropped after the object is destructed. */
 struct _acu_shared_node {
 	struct _acu_node base;
-	acu_unique *tail;
-	int refcnt, weakcnt;
-	#ifdef ACU_THREAD_SAFE
-		int shared;
-		pthread_mutex_t lock;
+	#ifndef ACU_THREAD_SAFE
+		struct _acu_tail_node *tail;
+		unsigned long long counts;
+	#else
+		_Atomic(struct _acu_tail_node *) tail;
+		atomic_ullong counts;
+		void *owner;		/* &_acu_self of the thread the counts are biased to, or NULL */
 	#endif
 };
 
-/* Global pointer to top of the main stack, and another pointer that either has the same value as _acu_stack_ptr, or NULL
- * _acu_latest is set to NULL at function entry, whenever it's accessed using acu_latest(), and when acu_attach or acu_destruct
+#define _ACU_STRONG 1ULL
+#define _ACU_WEAK (1ULL << 32)
+#define _ACU_STRONG_OF(n) ((n) & (_ACU_WEAK - 1))
+
+#ifdef ACU_THREAD_SAFE
+/* The counts of a shared node are biased to the thread that shared the object: until a reference to it is handed
+ * off, no other thread can hold one, so the owner updates the counts with plain loads and stores. Handing off any
+ * reference clears the owner, after which all threads use atomic operations. Signalling the handoff to the receiving
+ * thread orders the last plain update before its first atomic one. */
+static __thread char _acu_self;
+#endif
+
+/* Add 'd' to the counts of shared node 's', and return the previous counts */
+static inline unsigned long long _acu_take_count(acu_shared *s, unsigned long long d)
+{
+	#ifndef ACU_THREAD_SAFE
+		s->counts += d;
+		return s->counts - d;
+	#else
+		unsigned long long n;
+		if (s->owner != &_acu_self) return atomic_fetch_add_explicit(&(s->counts), d, memory_order_relaxed);
+		n = atomic_load_explicit(&(s->counts), memory_order_relaxed);
+		atomic_store_explicit(&(s->counts), n + d, memory_order_relaxed);
+		return n;
+	#endif
+}
+
+/* Subtract 'd' from the counts of shared node 's', and return the previous counts. Taking a reference needs no
+ * ordering, as the taker already holds one; dropping one releases the writes made through it, and the thread that
+ * finds the counts selected by 'mask' were the last 'd' acquires them all before it destructs. The acquire is a load
+ * of the counts just dropped rather than a fence, which ThreadSanitizer does not understand. */
+static inline unsigned long long _acu_drop_count(acu_shared *s, unsigned long long d, unsigned long long mask)
+{
+	#ifndef ACU_THREAD_SAFE
+		s->counts -= d;
+		return s->counts + d;
+	#else
+		unsigned long long n;
+		if (s->owner == &_acu_self)
+		{
+			n = atomic_load_explicit(&(s->counts), memory_order_relaxed);
+			atomic_store_explicit(&(s->counts), n - d, memory_order_relaxed);
+			return n;
+		}
+		n = atomic_fetch_sub_explicit(&(s->counts), d, memory_order_release);
+		if ((n & mask) == d) (void)atomic_load_explicit(&(s->counts), memory_order_acquire);
+		return n;
+	#endif
+}
+
+#ifdef ACU_THREAD_SAFE
+/* Unbias the counts of the shared node unique node 'u' references, if any, as 'u' is about to be handed off */
+static void _acu_unbias(acu_unique *u)
+{
+	acu_shared *s = u->base.ptr;
+	if ((u->base.del == _acu_del_strong_ref || u->base.del == _acu_del_weak_ref) && s->owner == &_acu_self)
+		s->owner = NULL;
+}
+#else
+	#define _acu_unbias(u)
+#endif
+
+/* _acu_latest either points to the latest node pushed to the main stack, or is NULL.
+ * It is set to NULL at function entry, whenever it's accessed using acu_latest(), and when acu_attach or acu_destruct
  * is called */
-__thread acu_unique *_acu_stack_ptr = NULL, *_acu_latest = NULL;
+__thread acu_unique *_acu_latest = NULL;
 __thread long _acu_scope = 0;
 
+/* Bulk destructors. Cleanup hands runs of consecutive nodes that have the same destructor to its registered bulk
+ * version, in batches of up to _ACU_BATCH object pointers, instead of calling the destructor once per node.
+ * free and the destructor of prefixed blocks of acu_std.c are registered from the start. */
+#define _ACU_MAX_BULK 8
+#define _ACU_BATCH 64
+
+static void _acu_free_bulk(void **ptrs, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) free(ptrs[i]);
+}
+
+static void _acu_free_prefixed_bulk(void **ptrs, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) _acu_free_prefixed(ptrs[i]);
+}
+
+static struct {
+	void (*del)(void *);
+	void (*bulk)(void **, int);
+} _acu_bulk[_ACU_MAX_BULK] = {{free, _acu_free_bulk}, {_acu_free_prefixed, _acu_free_prefixed_bulk}};
+static int _acu_nbulk = 2;
+
+int acu_register_bulk(void (*del)(void *), void (*bulk)(void **, int))
+{
+	int i;
+	for (i = 0; i < _acu_nbulk; i++) if (_acu_bulk[i].del == del) break;
+	if (i == _ACU_MAX_BULK) return -1;
+	_acu_bulk[i].del = del;
+	_acu_bulk[i].bulk = bulk;
+	if (i == _acu_nbulk) _acu_nbulk++;
+	return 0;
+}
+
+/* Pending run of objects with the same destructor, local to one cleanup pass */
+struct _acu_batch {
+	void (*del)(void *);
+	void (*bulk)(void **, int);
+	int n;
+	void *ptrs[_ACU_BATCH];
+};
+
+static void _acu_batch_flush(struct _acu_batch *b)
+{
+	if (b->n) (b->bulk)(b->ptrs, b->n);
+	b->n = 0;
+}
+
+/* Destruct object 'ptr' using destructor 'del', or add it to the batch if 'del' has a bulk version. The batch
+ * is flushed before any other destructor is called, so objects are destructed in the same order as without it. */
+static void _acu_batch_del(struct _acu_batch *b, void (*del)(void *), void *ptr)
+{
+	if (del != b->del)
+	{
+		int i;
+		_acu_batch_flush(b);
+		b->del = del;
+		b->bulk = NULL;
+		for (i = 0; i < _acu_nbulk; i++) if (_acu_bulk[i].del == del) b->bulk = _acu_bulk[i].bulk;
+	}
+	if (b->bulk)
+	{
+		b->ptrs[b->n++] = ptr;
+		if (b->n == _ACU_BATCH) _acu_batch_flush(b);
+	}
+	else if (del) (del)(ptr);
+}
+
+/* Destructor arguments. acu_new_unique_arg stores the argument in a wide node of the slab, or with ACU_ARRAY_STACK
+ * in a dead entry right below the node. Where the object and destructor of such a node would be moved to another
+ * node, which has no room for the argument, they are first detached to a shim holding all three. */
+#ifndef ACU_ARRAY_STACK
+	struct _acu_wide_node {
+		acu_unique node;
+		uintptr_t arg;
+	};
+	#define _ACU_ARG_OF(u) (((struct _acu_wide_node *)(u))->arg)
+#else
+	#define _ACU_ARG_OF(u) ((uintptr_t)((u) - 1)->base.ptr)
+#endif
+
+/* Call destructor 'del' of object 'ptr' of a node with properties 'prop', with argument 'arg' if it takes one */
+#define _ACU_CALL(prop, del, ptr, arg) ((prop) & _ACU_ARG ? ((void (*)(void *, uintptr_t))(del))(ptr, arg) : (del)(ptr))
+
+struct _acu_arg_shim {
+	struct _acu_node base;
+	uintptr_t arg;
+};
+
+static void _acu_del_arg_shim(void *p)
+{
+	struct _acu_arg_shim *s = p;
+	((void (*)(void *, uintptr_t))s->base.del)(s->base.ptr, s->arg);
+	free(s);
+}
+
+/* Detach the object, destructor and argument of unique node 'u' to a shim, if its destructor takes an argument */
+static void _acu_detach_arg(acu_unique *u)
+{
+	struct _acu_arg_shim *s;
+	if (!(u->properties & _ACU_ARG)) return;
+	s = malloc_t(sizeof(struct _acu_arg_shim));
+	s->base = u->base;
+	s->arg = _ACU_ARG_OF(u);
+	u->base.ptr = s;
+	u->base.del = _acu_del_arg_shim;
+	u->properties &= ~_ACU_ARG;
+}
+
+#ifdef ACU_THREAD_SAFE
+/* Deferred destruction. Cleanup pushes deferred objects to a lock-free stack (a list linked through tail nodes,
+ * pushed with compare-and-swap), and posts a semaphore when it finds the stack empty. The reaper thread waits on
+ * the semaphore, takes the whole list, reverses it to the order of queuing, and destructs the objects. */
+static _Atomic(struct _acu_tail_node *) _acu_reap_head = NULL;
+static sem_t _acu_reap_sem;
+static pthread_once_t _acu_reap_once = PTHREAD_ONCE_INIT;
+static int _acu_reap_err = 0, _acu_reap_started = 0;
+
+static void *_acu_reaper(void *dummy)
+{
+	for (;;)
+	{
+		struct _acu_tail_node *t, *r = NULL;
+		while (sem_wait(&_acu_reap_sem)) ;
+		t = atomic_exchange_explicit(&_acu_reap_head, NULL, memory_order_acquire);
+		while (t)
+		{
+			struct _acu_tail_node *n = t->next;
+			t->next = r;
+			r = t;
+			t = n;
+		}
+		while (r)
+		{
+			t = r;
+			r = r->next;
+			(t->base.del)(t->base.ptr);
+			free(t);
+		}
+	}
+	return NULL;
+}
+
+static void _acu_reap_start(void)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+	if ((_acu_reap_err = sem_init(&_acu_reap_sem, 0, 0) ? errno : 0)) return;
+	(void)pthread_attr_init(&attr);
+	(void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if ((_acu_reap_err = pthread_create(&tid, &attr, _acu_reaper, NULL)) == 0)
+	{
+		_acu_reap_started = 1;
+		atexit(acu_drain_deferred);
+	}
+	(void)pthread_attr_destroy(&attr);
+}
+
+/* Queue object 'ptr' with destructor 'del' to the reaper. Return 0 if out of memory, the caller then destructs it. */
+static int _acu_reap_push(void (*del)(void *), void *ptr)
+{
+	struct _acu_tail_node *t = malloc(sizeof(struct _acu_tail_node));
+	if (t == NULL) return 0;
+	t->base.ptr = ptr;
+	t->base.del = del;
+	struct _acu_tail_node *old = atomic_load_explicit(&_acu_reap_head, memory_order_relaxed);
+	do t->next = old;
+	while (!atomic_compare_exchange_weak_explicit(&_acu_reap_head, &old, t, memory_order_release,
+		memory_order_relaxed));
+	if (old == NULL) (void)sem_post(&_acu_reap_sem);
+	return 1;
+}
+
+void acu_defer_destruct(acu_unique *u)
+{
+	if (u->base.del == (void (*)(void *))pthread_mutex_unlock || u->base.del == _acu_del_strong_ref
+			|| u->base.del == _acu_del_weak_ref)
+		throw(new_name_exception("acu_defer_destruct: locks and references cannot be deferred"));
+	if (u->properties & _ACU_BOUND) throw(new_name_exception("acu_defer_destruct: bound to the creating thread"));
+	(void)pthread_once(&_acu_reap_once, _acu_reap_start);
+	if (_acu_reap_err) throw(new_io_exception(_acu_reap_err, "", "acu_defer_destruct"));
+	_acu_detach_arg(u);
+	u->properties |= _ACU_DEFERRED;
+}
+
+/* Queue a node that posts semaphore 'done' behind everything queued so far, and wait for it */
+void acu_drain_deferred(void)
+{
+	sem_t done;
+	if (!_acu_reap_started || sem_init(&done, 0, 0)) return;
+	if (_acu_reap_push((void (*)(void *))sem_post, &done)) while (sem_wait(&done)) ;
+	(void)sem_destroy(&done);
+}
+#endif
+
+/* Destruct object 'ptr' of a node with properties 'prop', either on the reaper, using the batch, or directly if
+ * the destructor takes argument 'arg' */
+static void _acu_cleanup_del(struct _acu_batch *b, int prop, void (*del)(void *), void *ptr, uintptr_t arg)
+{
+	if (prop & _ACU_ARG)
+	{
+		_acu_batch_flush(b);
+		if (del) _ACU_CALL(prop, del, ptr, arg);
+		return;
+	}
+	#ifdef ACU_THREAD_SAFE
+		if (prop & _ACU_DEFERRED && del && del != _acu_del_strong_ref && del != _acu_del_weak_ref && _acu_reap_push(del, ptr))
+			return;
+	#endif
+	_acu_batch_del(b, del, ptr);
+}
+
+#ifndef ACU_ARRAY_STACK
 
-/* Destruct a unique node without updating stack pointers.
- * The caller must make sure that the stack pointer will be valid after cleanup. */
-static void _acu_destruct(acu_unique *u)
+/* Global pointer to top of the main stack */
+__thread acu_unique *_acu_stack_ptr = NULL;
+
+/* Creation number of the latest node linked to the main stack. Numbers order the nodes a scope yields among each
+ * other, and are renumbered from zero when the counter reaches _ACU_SEQ_LIMIT, which can be lowered for testing. */
+#ifndef _ACU_SEQ_LIMIT
+	#define _ACU_SEQ_LIMIT UINT_MAX
+#endif
+static __thread unsigned _acu_seq = 0;
+
+/* Node of the main stack moved by the latest acu_yield, or NULL. A run of yields usually inserts next to it, so
+ * that it saves walking down the nodes of the scope being left. */
+static __thread acu_unique *_acu_yield_at = NULL;
+
+/* Per-thread slab allocators for unique nodes of the main stack, one for plain and one for wide nodes. Nodes are
+ * carved from chunks of _ACU_SLAB_CHUNK nodes, and released nodes are recycled through a freelist threaded through
+ * their 'next' pointers, so that node churn does not reach the general-purpose allocator. Chunks are returned to
+ * the heap only at thread exit, and only if no node of the thread is alive. */
+#define _ACU_SLAB_CHUNK 128
+
+struct _acu_slab_chunk {
+	struct _acu_slab_chunk *next;
+};
+
+struct _acu_slab {
+	struct _acu_slab_chunk *chunks;
+	acu_unique *free;
+	char *carved, *end;	/* part of the latest chunk not yet carved */
+	size_t size;		/* size of the nodes */
+};
+
+static __thread struct _acu_slab _acu_slab = {NULL, NULL, NULL, NULL, sizeof(acu_unique)};
+static __thread struct _acu_slab _acu_wide_slab = {NULL, NULL, NULL, NULL, sizeof(struct _acu_wide_node)};
+static __thread struct acu_slab_stats _acu_slab_stats;
+
+static acu_unique *_acu_slab_alloc(struct _acu_slab *s)
 {
-	if (u->base.del) (u->base.del)(u->base.ptr);
+	acu_unique *u = s->free;
+	if (u)
+	{
+		s->free = u->next;
+		_acu_slab_stats.reuses++;
+	}
+	else
+	{
+		if (s->carved == s->end)
+		{
+			struct _acu_slab_chunk *c = malloc(sizeof(struct _acu_slab_chunk) + _ACU_SLAB_CHUNK * s->size);
+			if (c == NULL) return NULL;
+			c->next = s->chunks;
+			s->chunks = c;
+			s->carved = (char *)(c + 1);
+			s->end = s->carved + _ACU_SLAB_CHUNK * s->size;
+			_acu_slab_stats.chunks++;
+		}
+		u = (acu_unique *)s->carved;
+		s->carved += s->size;
+	}
+	_acu_slab_stats.allocs++;
+	_acu_slab_stats.live++;
+	return u;
+}
+
+static void _acu_slab_release(struct _acu_slab *s, acu_unique *u)
+{
+	u->next = s->free;
+	s->free = u;
+	_acu_slab_stats.live--;
+}
+
+#ifdef ACU_THREAD_SAFE
+static void _acu_slab_destroy(struct _acu_slab *s)
+{
+	while (s->chunks)
+	{
+		struct _acu_slab_chunk *c = s->chunks;
+		s->chunks = c->next;
+		free(c);
+	}
+	s->free = NULL;
+	s->carved = s->end = NULL;
+}
+
+/* Return all chunks of the calling thread to the heap if none of its nodes is in use */
+static void _acu_stack_destroy(void)
+{
+	if (_acu_slab_stats.live) return;
+	_acu_slab_destroy(&_acu_slab);
+	_acu_slab_destroy(&_acu_wide_slab);
+}
+#endif
+
+/* Copy slab counters of the calling thread to *st */
+void acu_get_slab_stats(struct acu_slab_stats *st) { *st = _acu_slab_stats; }
+
+
+/* Release the memory of unique node 'u', unless it is embedded in its object */
+static void _acu_release(acu_unique *u)
+{
+	if (u->properties & _ACU_SLAB) _acu_slab_release(u->properties & _ACU_WIDE ? &_acu_wide_slab : &_acu_slab, u);
+	else if (!(u->properties & _ACU_EMBEDDED)) free(u);
+}
+
+/* Unlink unique node 'u' from the main stack and release its memory without calling the destructor */
+static void _acu_unlink(acu_unique *u)
+{
+	if (u == _acu_yield_at) _acu_yield_at = NULL;
 	if (u->prev) u->prev->next = u->next;
-	if (u->next) u->next->prev = u->prev;
-	free(u);
+	if (u->next) u->next->prev = u->prev; else _acu_stack_ptr = u->prev;
+	_acu_release(u);
+}
+
+/* Unlink and destruct all unique nodes in the main stack whose scope is larger than minscope. The stack is kept
+ * ordered by scope (see acu_yield), so these are all on top of the stack, and no other node is visited. */
+void _acu_cleanup(long minscope)
+{
+	acu_unique *c;
+	struct _acu_batch b;
+	b.del = NULL;
+	b.bulk = NULL;
+	b.n = 0;
+	#ifdef ACU_UNWIND
+		struct _exc_suspended x;
+		x.e = NULL;
+		if (_exc_unwinding) _exc_suspend(&x);
+	#endif
+	while ((c = _acu_stack_ptr) && c->scope > minscope)
+	{
+		void (*del)(void *) = c->base.del;
+		void *ptr = c->base.ptr;
+		int prop = c->properties;
+		uintptr_t arg = prop & _ACU_ARG ? _ACU_ARG_OF(c) : 0;
+		if (c == _acu_yield_at) _acu_yield_at = NULL;
+		_acu_stack_ptr = c->prev;
+		if (c->prev) c->prev->next = NULL;
+		_acu_release(c);
+		_acu_cleanup_del(&b, prop, del, ptr, arg);
+	}
+	_acu_batch_flush(&b);
+	#ifdef ACU_UNWIND
+		if (x.e) _exc_resume(&x);
+	#endif
+}
+
+/* Order nodes by creation number, for qsort */
+static int _acu_seq_cmp(const void *a, const void *b)
+{
+	unsigned x = (*(acu_unique *const *)a)->seq, y = (*(acu_unique *const *)b)->seq;
+	return (x > y) - (x < y);
+}
+
+/* Renumber the nodes of the main stack from zero in the order of their creation numbers. Without memory for
+ * sorting, the numbers are only shifted down by the smallest one, which keeps the order but may free no room. */
+static void _acu_renumber(void)
+{
+	acu_unique *c, **v;
+	size_t n = 0, i;
+	unsigned min = _acu_seq;
+	for (c = _acu_stack_ptr; c; c = c->prev)
+	{
+		if (c->seq < min) min = c->seq;
+		n++;
+	}
+	if (n && (v = malloc(n * sizeof *v)))
+	{
+		for (c = _acu_stack_ptr, i = 0; c; c = c->prev) v[i++] = c;
+		qsort(v, n, sizeof *v, _acu_seq_cmp);
+		for (i = 0; i < n; i++) v[i]->seq = i;
+		free(v);
+		_acu_seq = n;
+		return;
+	}
+	for (c = _acu_stack_ptr; c; c = c->prev) c->seq -= min;
+	_acu_seq -= min;
+}
+
+/* Link unique node 'u' to the top of the main stack and return pointer to it */
+static acu_unique *_acu_link(acu_unique *u)
+{
+	if (_acu_seq >= _ACU_SEQ_LIMIT) _acu_renumber();
+	u->seq = ++_acu_seq;
+	u->prev = _acu_stack_ptr;
+	u->next = NULL;
+	if (_acu_stack_ptr) _acu_stack_ptr->next = u;
+	_acu_stack_ptr = u;
+	return u;
+}
+
+/* Push a new unique node to the main stack and return pointer to it, or NULL if out of memory */
+static acu_unique *_acu_push(void)
+{
+	acu_unique *u = _acu_slab_alloc(&_acu_slab);
+	if (u == NULL) return NULL;
+	_acu_link(u)->properties = _ACU_SLAB;
+	return u;
+}
+
+/* Push a new wide unique node with destructor argument 'arg' to the main stack, or return NULL if out of memory */
+static acu_unique *_acu_push_arg(uintptr_t arg)
+{
+	acu_unique *u = _acu_slab_alloc(&_acu_wide_slab);
+	if (u == NULL) return NULL;
+	_ACU_ARG_OF(u) = arg;
+	_acu_link(u)->properties = _ACU_SLAB | _ACU_WIDE | _ACU_ARG;
+	return u;
+}
+
+/* Replace the node prefixed to a block by a node of the slab, so that it's safe to hand out: the block may then be
+ * reallocated, or freed by another owner while the node still is in the stack, e.g. after acu_swap */
+static acu_unique *_acu_promote(acu_unique *h)
+{
+	acu_unique *u = _acu_slab_alloc(&_acu_slab);
+	if (u == NULL) throw(new_mem_exception("acu_latest", _ACU_SLAB_CHUNK * sizeof(acu_unique)));
+	*u = *h;
+	u->properties = (h->properties & ~(_ACU_EMBEDDED | _ACU_PREFIXED)) | _ACU_SLAB;
+	if (_acu_yield_at == h) _acu_yield_at = u;
+	if (u->prev) u->prev->next = u;
+	if (u->next) u->next->prev = u; else _acu_stack_ptr = u;
+	return u;
 }
 
-/* Pop and destruct all unique nodes in a stack pointed to by *stack_ref_ptr, until node 'u' (inclusive), or
- * all nodes if u == NULL. However, do not touch nodes whose scope is smaller than minscope (yielded nodes).
+#else
+
+/* Per-thread array of unique nodes. The array is segmented into chunks of _ACU_ARRAY_CHUNK entries that are
+ * never moved, so that pointers to the entries are stable handles. Pushing is a bump of _acu_top, and scopes
+ * memorize the value of _acu_top at their entry. Destructed entries below the top are marked dead, and the top
+ * is lowered past them whenever the entry above them is popped, or reused if directly below the top. */
+#define _ACU_ARRAY_CHUNK 1024
+
+__thread long _acu_top = 0;
+static __thread acu_unique **_acu_array_chunks = NULL;
+static __thread long _acu_array_nchunks = 0;
+
+#define _ACU_ENTRY(i) (&(_acu_array_chunks[(i) / _ACU_ARRAY_CHUNK][(i) % _ACU_ARRAY_CHUNK]))
+
+#ifdef ACU_THREAD_SAFE
+/* Return all chunks of the calling thread to the heap if the array is empty */
+static void _acu_stack_destroy(void)
+{
+	if (_acu_top) return;
+	while (_acu_array_nchunks) free(_acu_array_chunks[--_acu_array_nchunks]);
+	free(_acu_array_chunks);
+	_acu_array_chunks = NULL;
+}
+#endif
+
+/* Lower the top of the array past dead entries */
+static void _acu_pop_dead(void)
+{
+	while (_acu_top > 0 && (_ACU_ENTRY(_acu_top - 1)->properties & _ACU_DEAD)) _acu_top--;
+}
+
+/* Mark unique node 'u' dead without calling the destructor, and pop it if it was on top of the array */
+static void _acu_unlink(acu_unique *u)
+{
+	u->properties = _ACU_DEAD;
+	if (u == _ACU_ENTRY(_acu_top - 1)) _acu_pop_dead();
+}
+
+/* Destruct entry 'c' in a cleanup sweep with batch 'b', unless it's dead or yielded to 'minscope' */
+static void _acu_sweep(struct _acu_batch *b, acu_unique *c, long minscope)
+{
+	int prop = c->properties;
+	if (prop & _ACU_DEAD || c->scope <= minscope) return;
+	c->properties = _ACU_DEAD;
+	_acu_cleanup_del(b, prop, c->base.del, c->base.ptr, prop & _ACU_ARG ? _ACU_ARG_OF(c) : 0);
+}
+
+/* Destruct all entries of the main stack from the top down to index 'mark' (inclusive). However, do not
+ * touch entries whose scope is smaller than minscope (yielded nodes). An entry reusing the dead entry below its
+ * neighbour is destructed before the neighbour. The sweep does not lower _acu_top until it's finished, so
+ * destructors may freely push and pop entries above the current top.
  */
-void _acu_cleanup(acu_unique *u, acu_unique **stack_ptr_ref, long minscope)
+void _acu_cleanup(long mark, long minscope)
 {
-	acu_unique **n = stack_ptr_ref, *next = NULL;
-	if (u) u = u->prev;
-	
-	while (*n != u)
+	long i;
+	struct _acu_batch b;
+	b.del = NULL;
+	b.bulk = NULL;
+	b.n = 0;
+	#ifdef ACU_UNWIND
+		struct _exc_suspended x;
+		x.e = NULL;
+		if (_exc_unwinding) _exc_suspend(&x);
+	#endif
+	for (i = _acu_top - 1; i >= mark; i--)
 	{
-		if ((*n)->scope > minscope)
+		acu_unique *c = _ACU_ENTRY(i);
+		if (c->properties & _ACU_NEWER_BELOW && i > mark) _acu_sweep(&b, c - 1, minscope);
+		_acu_sweep(&b, c, minscope);
+	}
+	_acu_batch_flush(&b);
+	_acu_pop_dead();
+	#ifdef ACU_UNWIND
+		if (x.e) _exc_resume(&x);
+	#endif
+}
+
+/* Bump the top of the array and return pointer to the new entry, or NULL if out of memory */
+static acu_unique *_acu_bump(void)
+{
+	if (_acu_top == _acu_array_nchunks * _ACU_ARRAY_CHUNK)
+	{
+		acu_unique *c = malloc(_ACU_ARRAY_CHUNK * sizeof(acu_unique));
+		acu_unique **t = c ? realloc(_acu_array_chunks, (_acu_array_nchunks + 1) * sizeof(acu_unique *)) : NULL;
+		if (t == NULL)
 		{
-			acu_unique *c = *n;
-			*n = c->prev;
-			_acu_destruct(c);
+			free(c);
+			return NULL;
 		}
-		else
+		_acu_array_chunks = t;
+		_acu_array_chunks[_acu_array_nchunks++] = c;
+	}
+	acu_unique *u = _ACU_ENTRY(_acu_top);
+	_acu_top++;
+	u->properties = 0;
+	return u;
+}
+
+/* Push a new entry to the array and return pointer to it, or NULL if out of memory. Replacing an object by a new
+ * one, created before the old one is destructed, leaves a dead entry directly below the top, and a loop doing so
+ * would grow the array without bound. A dead entry of the current scope directly below the top entry of the
+ * current scope is therefore reused, and the top entry flagged so that cleanup destructs the newer entry below it
+ * first. Both are in the same chunk, and the top entry must not need its lower neighbour for its argument. */
+static acu_unique *_acu_push(void)
+{
+	if (_acu_top > 1 && (_acu_top - 1) % _ACU_ARRAY_CHUNK)
+	{
+		acu_unique *n = _ACU_ENTRY(_acu_top - 1), *d = n - 1;
+		if (!(n->properties & (_ACU_DEAD | _ACU_ARG)) && n->scope == _acu_scope
+			&& d->properties & _ACU_DEAD && d->scope == _acu_scope)
 		{
-			if (n == stack_ptr_ref) (*n)->next = next;
-			next = *n;
-			n = &((*n)->prev);
+			n->properties |= _ACU_NEWER_BELOW;
+			d->properties = 0;
+			return d;
 		}
 	}
+	return _acu_bump();
 }
 
-/* Create a new unique node with reference to 'ptr' with destructor 'del' to stack pointed to by *tailptr.
- * Return pointer to the created node */
-static acu_unique *_acu_new_unique(void *ptr, void (*del)(void *), acu_unique **stack_ptr_ref)
+/* Push a dead entry holding destructor argument 'arg' and a new entry above it in the same chunk, and return pointer
+ * to the latter, or NULL if out of memory */
+static acu_unique *_acu_push_arg(uintptr_t arg)
 {
-	acu_unique *u = calloc_t(1, sizeof(acu_unique));
+	acu_unique *h;
+	if (_acu_top % _ACU_ARRAY_CHUNK == _ACU_ARRAY_CHUNK - 1)
+	{
+		if ((h = _acu_bump()) == NULL) return NULL;
+		h->properties = _ACU_DEAD;
+		h->scope = _acu_scope;
+	}
+	if ((h = _acu_bump()) == NULL) return NULL;
+	h->base.ptr = (void *)arg;
+	h->properties = _ACU_DEAD;
+	h->scope = _acu_scope;
+	h = _acu_bump();
+	h->properties = _ACU_ARG;
+	return h;
+}
 
+/* The array does not use the slab, report zeros */
+void acu_get_slab_stats(struct acu_slab_stats *st) { struct acu_slab_stats z = {0}; *st = z; }
+
+#endif
+
+/* Initialize unique node 'u' just pushed to the main stack with reference to 'ptr' with destructor 'del' */
+static acu_unique *_acu_init(acu_unique *u, void *ptr, void (*del)(void *))
+{
 	u->base.ptr = ptr;
 	u->base.del = del;
-	u->prev = _acu_stack_ptr;
-	if (*stack_ptr_ref) (*stack_ptr_ref)->next = u;
-	*stack_ptr_ref = u;
 	u->scope = _acu_scope;
-	u->properties = _ACU_TRANSFERRABLE | _ACU_SHAREABLE | _ACU_SUBMITTABLE;
+	u->properties |= _ACU_OWNERSHIP;
+	_acu_latest = u;
 	return u;
 }
 
-/* Create a new unique node with reference to 'ptr' with destructor 'del' to the main stack, return pointer to the created node */
-acu_unique *acu_new_unique(void *ptr, void (*del)(void *)) {
-	acu_unique *u = _acu_new_unique(ptr, del, &_acu_stack_ptr);
-	_acu_latest = u;
-	return u;
+/* Create a new unique node with reference to 'ptr' with destructor 'del' to the main stack, return pointer to the created node.
+ * If there's no memory for the node, destruct the object before throwing, so that wrappers do not leak it. */
+acu_unique *acu_new_unique(void *ptr, void (*del)(void *))
+{
+	acu_unique *u = _acu_push();
+	if (u == NULL)
+	{
+		if (del) (del)(ptr);
+		throw(new_mem_exception("acu_new_unique", sizeof(acu_unique)));
+	}
+	return _acu_init(u, ptr, del);
+}
+
+/* Create a new unique node with reference to 'ptr' with destructor 'del' taking argument 'arg' */
+acu_unique *acu_new_unique_arg(void *ptr, uintptr_t arg, void (*del)(void *, uintptr_t))
+{
+	acu_unique *u = _acu_push_arg(arg);
+	if (u == NULL)
+	{
+		if (del) (del)(ptr, arg);
+		throw(new_mem_exception("acu_new_unique_arg", sizeof(acu_unique)));
+	}
+	return _acu_init(u, ptr, (void (*)(void *))del);
+}
+
+/* Push a node without ownership calling 'fn' with 'arg' at the end of the current scope */
+void acu_defer(void (*fn)(void *), void *arg)
+{
+	acu_unique *u = _acu_push();
+	if (u == NULL)
+	{
+		fn(arg);
+		throw(new_mem_exception("acu_defer", sizeof(acu_unique)));
+	}
+	_acu_init(u, arg, fn)->properties &= ~_ACU_OWNERSHIP;
+	_acu_latest = NULL;
+}
+
+/* Push header 'h' embedded in an object to the main stack as a unique node with reference to 'h' itself */
+acu_unique *acu_register_embedded(acu_header *h, void (*del)(void *))
+{
+	#ifndef ACU_ARRAY_STACK
+		acu_unique *u = _acu_link(h);
+		u->properties = _ACU_EMBEDDED;
+		return _acu_init(u, h, del);
+	#else
+		return acu_new_unique(h, del);
+	#endif
+}
+
+/* Destructor of blocks with a prefixed node, 'ptr' points to the payload */
+void _acu_free_prefixed(void *ptr) { free((char *)ptr - _ACU_PREFIX); }
+
+#ifndef ACU_ARRAY_STACK
+/* Push the node prefixed to block 'b' to the main stack, with reference to the payload, return pointer to it */
+void *_acu_push_prefixed(void *b)
+{
+	acu_unique *u = _acu_link(b);
+	u->properties = _ACU_EMBEDDED | _ACU_PREFIXED;
+	return _acu_init(u, (char *)b + _ACU_PREFIX, _acu_free_prefixed)->base.ptr;
+}
+#endif
+
+/* Reallocate the object of unique pointer 'u' to 's' bytes, following strong reference first, and return pointer
+ * to it. Return NULL leaving the object intact if out of memory. */
+/* Mark the object of unique pointer 'u' bound to the calling thread, so that it's never destructed on another */
+void _acu_bind_thread(acu_unique *u)
+{
+	u->properties |= _ACU_BOUND;
+}
+
+void *_acu_realloc(acu_unique *u, size_t s)
+{
+	if (u->base.del == _acu_del_weak_ref) throw(new_name_exception("acu_realloc: cannot modify weakly referenced object"));
+	struct _acu_node *p = (struct _acu_node *)u;
+	char *b;
+	if (p->del == _acu_del_strong_ref) p = p->ptr;
+	if (p->del == _acu_del_arg_shim) p = p->ptr;
+	if (p->del != _acu_free_prefixed) b = realloc(p->ptr, s);
+	else if (s > (size_t)-1 - _ACU_PREFIX || (b = realloc((char *)p->ptr - _ACU_PREFIX, _ACU_PREFIX + s)) == NULL) return NULL;
+	else b += _ACU_PREFIX;
+	if (b) p->ptr = b;
+	return b;
 }
 
 /* Create an empty unique node and return pointer to it */
@@ -120,24 +809,35 @@ acu_unique *acu_reserve(void) { return acu_new_unique(NULL, NULL); }
 acu_unique *acu_latest(void) {
 	acu_unique *u = _acu_latest;
 	if (u == NULL) throw(new_name_exception("acu_latest: no object available"));
+	#ifndef ACU_ARRAY_STACK
+		if (u->properties & _ACU_PREFIXED) u = _acu_promote(u);
+	#endif
 	_acu_latest = NULL;
 	return u;
 }
 
-/* Destruct unique node 'u' in the main stack. Adjust stack pointer if 'u' was on top of the stack. */
+/* Unlink unique node 'u' from the main stack, and destruct it. Unlinking first allows the destructor to free
+ * an object with an embedded node. */
 void acu_destruct(acu_unique *u)
 {
+	void (*del)(void *) = u->base.del;
+	void *ptr = u->base.ptr;
+	int prop = u->properties;
+	uintptr_t arg = prop & _ACU_ARG ? _ACU_ARG_OF(u) : 0;
 	_acu_latest = NULL;
-	if (u == _acu_stack_ptr) _acu_stack_ptr = u->prev;
-	_acu_destruct(u);
+	_acu_unlink(u);
+	if (del) _ACU_CALL(prop, del, ptr, arg);
 }
 
-/* Update pointer to the base object, follow chain of forward links first */
+/* Update pointer to the base object, follow chain of forward links first. The new object is not prefixed, so
+ * it is freed with plain free if the old one was. */
 void acu_update(acu_unique *u, void *newptr)
 {
 	if (u->base.del == _acu_del_weak_ref) throw(new_name_exception("acu_update: cannot modify weakly referenced object"));
 	struct _acu_node *p = (struct _acu_node *)u;
 	if (p->del == _acu_del_strong_ref) p = p->ptr;
+	if (p->del == _acu_del_arg_shim) p = p->ptr;
+	if (p->del == _acu_free_prefixed) p->del = free;
 	p->ptr = newptr;
 }
 
@@ -147,6 +847,7 @@ void *acu_get_ptr(acu_unique *u)
 	if (u->base.del == _acu_del_weak_ref) throw(new_name_exception("acu_update: cannot access weakly referenced object"));
 	struct _acu_node *p = (struct _acu_node *)u;
 	if (p->del == _acu_del_strong_ref) p = p->ptr;
+	if (p->del == _acu_del_arg_shim) p = p->ptr;
 	return p->ptr;
 }
 
@@ -154,17 +855,57 @@ void *acu_get_ptr(acu_unique *u)
 void acu_transfer(acu_unique *from, acu_unique *to)
 {
 	if (from->properties & _ACU_TRANSFERRABLE == 0) throw(new_name_exception("acu_transfer: non-transferrable pointer"));
+	if (to->properties & _ACU_EMBEDDED) throw(new_name_exception("acu_transfer: cannot transfer to an embedded node"));
+	_acu_detach_arg(from);
+	_acu_unbias(from);
+	to->properties &= ~_ACU_ARG;
 	to->base = from->base;
-	to->properties = from->properties;
+	to->properties = (to->properties & ~_ACU_MOVED) | (from->properties & _ACU_MOVED);
 	from->base.del = NULL; // prevent the object whose ownership was transferred to 'to' from being destructed
 	acu_destruct(from);
 }
 
-/* Pass unique pointer to the enclosing dynamic scope (e.g., the calling function) */
+/* Pass unique pointer to the enclosing dynamic scope (e.g., the calling function). The linked stack is kept
+ * ordered by scope, so that scopes need no markers and cleanup never visits nodes that survive it: the node is
+ * moved down below the nodes of the scopes it leaves, into the segment of the enclosing scope, where it is placed
+ * by creation number among the nodes yielded before it, so that all are still destructed in reverse order of
+ * creation. The search starts at the node moved by the previous yield if that is in the same segment or is the
+ * lowest node of the scopes being left, so that yielding a run of nodes oldest or newest first costs O(1) per
+ * node. Entries of the array stack cannot move, but the array sweep is bounded by the index memorized at scope
+ * entry instead. */
 void acu_yield(acu_unique *u)
 {
 	if (u->properties & _ACU_TRANSFERRABLE == 0) throw(new_name_exception("acu_yield: non-transferrable pointer"));
-	if (u->scope > _acu_scope - 1) u->scope = _acu_scope - 1;
+	if (u->scope <= _acu_scope - 1) return;
+	#ifndef ACU_ARRAY_STACK
+		long scope = _acu_scope - 1;
+		acu_unique *above, *p = _acu_yield_at;
+		if (p && p != u && p->scope == scope) above = p->next;
+		else if (p && p->scope > scope && (p->prev == NULL || p->prev->scope <= scope))
+		{
+			above = p;
+			p = p->prev;
+		}
+		else
+		{
+			above = u;
+			p = u->prev;
+			while (p && p->scope > scope) { above = p; p = p->prev; }
+		}
+		while (p && p->scope == scope && p->seq > u->seq) { above = p; p = p->prev; }
+		while (above != u && above->scope == scope && above->seq < u->seq) { p = above; above = above->next; }
+		_acu_yield_at = u;
+		u->scope = scope;
+		if (above == u) return;
+		u->prev->next = u->next;
+		if (u->next) u->next->prev = u->prev; else _acu_stack_ptr = u->prev;
+		u->prev = p;
+		u->next = above;
+		above->prev = u;
+		if (p) p->next = u;
+	#else
+		u->scope = _acu_scope - 1;
+	#endif
 }
 
 /* Swap the contents of two unique pointers */
@@ -172,45 +913,50 @@ void acu_swap(acu_unique *a, acu_unique *b)
 {
 	if (a->properties & b->properties & _ACU_TRANSFERRABLE == 0)
 		throw(new_name_exception("acu_swap: non-transferrable pointer"));
+	if ((a->properties | b->properties) & _ACU_EMBEDDED) throw(new_name_exception("acu_swap: embedded node"));
+	_acu_detach_arg(a);
+	_acu_detach_arg(b);
+	_acu_unbias(a);
+	_acu_unbias(b);
 	struct _acu_node t = a->base; a->base = b->base; b->base = t;
-	int p = a->properties; a->properties = b->properties; b->properties = p;
+	int p = a->properties & _ACU_MOVED;
+	a->properties = (a->properties & ~_ACU_MOVED) | (b->properties & _ACU_MOVED);
+	b->properties = (b->properties & ~_ACU_MOVED) | p;
 }
 
 /* Destructor for a unique pointer with a weak reference to a shared pointer */
 static void _acu_del_weak_ref(void *p)
 {
 	acu_shared *s = (acu_shared *)p;
-	if (
-	#ifndef ACU_THREAD_SAFE
-		--s->weakcnt == 0
-	#else
-		__sync_sub_and_fetch(&(s->weakcnt), 1) == 0
-	#endif
-	)
+	if (_acu_drop_count(s, _ACU_WEAK, ~0ULL) == _ACU_WEAK) free(s);
+}
+
+/* Pop and destruct all nodes submitted to shared object 's' */
+static void _acu_cleanup_tail(acu_shared *s)
+{
+	while (s->tail)
 	{
-		#ifdef ACU_THREAD_SAFE
-			(void)pthread_mutex_destroy(&(s->lock));
-		#endif
-		free(s);
+		struct _acu_tail_node *t = s->tail;
+		s->tail = t->next;
+		if (t->base.del) (t->base.del)(t->base.ptr);
+		free(t);
 	}
 }
 
-/* Destructor for a unique node with a strong reference to a shared node */
+/* Destructor for a unique node with a strong reference to a shared node. If there were no weak references when the
+ * last strong one was dropped, none can be made any more, and the shared node is freed without dropping the weak
+ * count of the strong references. */
 static void _acu_del_strong_ref(void *p)
 {
 	acu_shared *s = (acu_shared *)p;
+	unsigned long long n = _acu_drop_count(s, _ACU_STRONG, _ACU_WEAK - 1);
 
-	if (
-	#ifndef ACU_THREAD_SAFE
-		--s->refcnt == 0
-	#else
-		__sync_sub_and_fetch(&(s->refcnt), 1) == 0
-	#endif
-	)
+	if (_ACU_STRONG_OF(n) == _ACU_STRONG)
 	{
-		_acu_cleanup(NULL, &(s->tail), 0);
+		_acu_cleanup_tail(s);
 		if (s->base.del) (s->base.del)(s->base.ptr);
-		_acu_del_weak_ref(p);
+		if (n == _ACU_STRONG + _ACU_WEAK) free(s);
+		else _acu_del_weak_ref(p);
 	}	
 }
 
@@ -220,82 +966,75 @@ static void _acu_del_strong_ref(void *p)
 acu_shared *acu_share(acu_unique *u)
 {
 	if (u->properties & _ACU_SHAREABLE == 0) throw(new_name_exception("acu_share: not shareable"));
+	if (u->properties & _ACU_EMBEDDED) throw(new_name_exception("acu_share: embedded node"));
+	#ifdef ACU_THREAD_SAFE
+		if (u->properties & _ACU_BOUND) throw(new_name_exception("acu_share: bound to the creating thread"));
+	#endif
+	_acu_detach_arg(u);
+	_acu_unbias(u);
 	acu_shared *s = calloc_t(1, sizeof(acu_shared));
 	s->base = u->base;
-	s->refcnt = s->weakcnt = 1;
+	#ifndef ACU_THREAD_SAFE
+		s->counts = _ACU_STRONG + _ACU_WEAK;
+	#else
+		atomic_init(&(s->tail), NULL);
+		atomic_init(&(s->counts), _ACU_STRONG + _ACU_WEAK);
+		s->owner = &_acu_self;
+	#endif
 	u->base.ptr = s;
 	u->base.del = _acu_del_strong_ref;
-	#ifdef ACU_THREAD_SAFE
-		if (pthread_mutex_init(&(s->lock), NULL)) throw(new_io_exception(errno, "", "acu_share"));
-	#endif
-
 	return s;
 }
 
-/* Create new unique node to main stack, pointing to shared node 's'. Increase reference count of 's' by one. */
+/* Create new unique node to main stack, pointing to shared node 's'. Increase reference count of 's' by one. The
+ * caller must hold a strong reference to 's'; with only a weak one, use acu_lock_reference. The count is taken
+ * first, so that acu_new_unique drops it again if it runs out of memory. */
 acu_unique *acu_new_reference(acu_shared *s)
 {
-	acu_unique *u = acu_new_unique(s, _acu_del_strong_ref);
-	#ifndef ACU_THREAD_SAFE
-		if (s->refcnt == 0) s->weakcnt++;
-		s->refcnt++;
-	#else 
-		s->shared = 1;
-		if (__sync_fetch_and_add(&(s->refcnt), 1) == 0) (void)__sync_fetch_and_add(&(s->weakcnt), 1);
-	#endif
-	return u;
+	(void)_acu_take_count(s, _ACU_STRONG);
+	return acu_new_unique(s, _acu_del_strong_ref);
 }
 
 
 /* Create new unique node with a weak reference to shared pointer 's'. */
 acu_unique *acu_new_weak_reference(acu_shared *s)
 {
+	(void)_acu_take_count(s, _ACU_WEAK);
 	acu_unique *u = acu_new_unique(s, _acu_del_weak_ref);
 	u->properties &= ~(_ACU_SUBMITTABLE | _ACU_SHAREABLE);
-	#ifndef ACU_THREAD_SAFE
-		s->weakcnt++;
-	#else 
-		s->shared = 1;
-		(void)__sync_fetch_and_add(&(s->weakcnt), 1);
-	#endif
 	return u;
 }
 
 /* Create a strong reference copy of a weak reference. This must be done for a resource to which the caller
  * only owns a weak reference before actually using the resource to guarantee that it actually exists,
- * and it won't be destructed while being used. Returns NULL if the resource is expired. */
+ * and it won't be destructed while being used. Returns NULL if the resource is expired. The count is taken with
+ * compare-and-swap that never increments it from zero, so an expired object is never seen as alive, even briefly.
+ * If no node can be allocated for the reference, acu_new_unique drops the count again before throwing. */
 acu_unique *acu_lock_reference(acu_unique *weakptr)
-BEGIN
+{
 	if (!weakptr || weakptr->base.del != _acu_del_weak_ref) throw(new_name_exception("acu_get_strong_reference: argument not a weakptr"));
 
 	acu_shared *s = weakptr->base.ptr;
-	if (
 	#ifndef ACU_THREAD_SAFE
-		s->refcnt++ == 0
+		if (_ACU_STRONG_OF(s->counts) == 0) return NULL;
+		s->counts += _ACU_STRONG;
 	#else
-		__sync_fetch_and_add(&(s->refcnt), 1) == 0
+		unsigned long long n = atomic_load_explicit(&(s->counts), memory_order_relaxed);
+		if (s->owner == &_acu_self)
+		{
+			if (_ACU_STRONG_OF(n) == 0) return NULL;
+			atomic_store_explicit(&(s->counts), n + _ACU_STRONG, memory_order_relaxed);
+		}
+		else
+			do if (_ACU_STRONG_OF(n) == 0) return NULL;
+			while (!atomic_compare_exchange_weak_explicit(&(s->counts), &n, n + _ACU_STRONG,
+					memory_order_acquire, memory_order_relaxed));
 	#endif
-	)
-	{
-		s->refcnt = 0;
-		acu_return NULL;
-	}
 
-	acu_unique *u;
-	TRY
-		u = acu_new_unique(s, _acu_del_strong_ref);
-	CATCH(e)
-		#ifndef ACU_THREAD_SAFE
-			s->refcnt--;
-		#else
-			(void)__sync_fetch_and_sub(&(s->refcnt), 1);
-		#endif
-		rethrow;
-	TRY_END
+	acu_unique *u = acu_new_unique(s, _acu_del_strong_ref);
 	u->properties &= ~(_ACU_SUBMITTABLE | _ACU_SHAREABLE);
-	acu_yield(u);
-	acu_return u;
-END
+	return u;
+}
 
 
 /* Detach unique node 'u' from the main stack and push a copy of it to stack of shared object 's'.
@@ -303,32 +1042,41 @@ END
  * detached from the main stack. This function is not called by other acu library functions, and
  * therefore it may rely on 'u' always being in the main cleanup stack */
 void acu_submit_to(acu_unique *u, acu_shared *s)
-BEGIN
+{
 	if (u->properties & _ACU_SUBMITTABLE == 0) throw(new_name_exception("acu_submit_to: cannot be submitted"));
-	/* Make a copy of a to ensure that caller will not have a handle to the object after attaching */
 	#ifdef ACU_THREAD_SAFE
-		/* Take mutex lock only if acu_new_[weak_]reference(s) has been called at least once, otherwise
-		 * there cannot be a race condition. Because of this, to achieve maximal performance the creator of
-		 * the shared object should do all acu_submit_to calls before creating additonal references
-                 * to the object. */
-		acu_unique *lockptr;
-		if (s->shared) lockptr = acu_pthread_mutex_lock(&(s->lock));
+		if (u->properties & _ACU_BOUND) throw(new_name_exception("acu_submit_to: bound to the creating thread"));
 	#endif
-	acu_unique *b = _acu_new_unique(u->base.ptr, u->base.del, &(s->tail));
-	#ifdef ACU_THREAD_SAFE
-		if (s->shared) acu_destruct(lockptr);
+	_acu_detach_arg(u);
+	_acu_unbias(u);
+	/* Make a copy of a to ensure that caller will not have a handle to the object after attaching */
+	struct _acu_tail_node *b = malloc_t(sizeof(struct _acu_tail_node));
+	b->base = u->base;
+	#ifndef ACU_THREAD_SAFE
+		b->next = s->tail;
+		s->tail = b;
+	#else
+		/* Threads submitting to the same shared object push to its stack with compare-and-swap. The stack is only
+		 * popped by _acu_cleanup_tail after the last strong reference is gone, when nobody can push any more,
+		 * so the push needs no lock. */
+		struct _acu_tail_node *old = atomic_load_explicit(&(s->tail), memory_order_relaxed);
+		do b->next = old;
+		while (!atomic_compare_exchange_weak_explicit(&(s->tail), &old, b, memory_order_release,
+			memory_order_relaxed));
 	#endif
 
 	/* Unlink the previous object, do not call the destructor, since we are effectively just moving
          * the node to a new context. */
-	if (u->prev) u->prev->next = u->next;
-	if (u->next) u->next->prev = u->prev; else _acu_stack_ptr = u->prev;
 	_acu_latest = NULL;
-	free(u);
-END
+	_acu_unlink(u);
+}
 
-void _acu_atexit_cleanup(void) { _acu_cleanup(NULL, &_acu_stack_ptr, 0); }
+#ifndef ACU_THREAD_SAFE
+	void _acu_atexit_cleanup(void) { _acu_cleanup_to(0, 0); }
+#else
+	void _acu_atexit_cleanup(void) { _acu_cleanup_to(0, 0); acu_drain_deferred(); }
+#endif
 #ifdef ACU_THREAD_SAFE
-	void _acu_thread_cleanup(void *dummy) { _acu_cleanup(NULL, &_acu_stack_ptr, 0); }
+	void _acu_thread_cleanup(void *dummy) { _acu_cleanup_to(0, 0); _acu_stack_destroy(); }
 #endif
 
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <setjmp.h>
+#include <stdint.h>
 
 
 /* Author Petteri Sevon
@@ -46,12 +47,14 @@
 *
 * The implementation defines macro brackets BEGIN ... END replacing normal curly brackets
 * { ... } around function definition, and optional inner context brackets BEGIN_SCOPE ...
-* END_SCOPE. Stack pointers are memorized at entry to any scope opened with a macro bracket,
-* and the closing macro bracket automatically releases any resources pushed to the
-* stack above the stack pointer memorized at entry to the scope.
+* END_SCOPE, or BEGIN_BLOCK ... END_BLOCK for inner scopes not exited by
+* acu_exit_scope(). Scope depth is memorized at entry to any scope opened with a macro
+* bracket, and the closing macro bracket automatically releases any resources pushed to
+* the stack within the scope, apart from those passed to enclosing scopes.
 *
 * Since the closing macro brackets cannot catch early exits from their scope, leaving
-* the scope using goto, continue, break or return will not trigger the destructors.
+* the scope using goto, continue, break or return will not trigger the destructors
+* (unless ACU_CLEANUP_ATTR is defined, see below).
 * However, the destruct operations will remain in the stack and will be done when the
 * cleaning up is triggered next time. Inner scope can be exited using macro acu_exit_scope(),
 * which will trigger cleaning up. Macro acu_return can be used to return with cleanup of
@@ -63,17 +66,106 @@
 */
 
 
-struct _acu_stack_node;
 typedef struct _acu_stack_node acu_unique;
 
 struct _acu_shared_node;
 typedef struct _acu_shared_node acu_shared;
 
-extern __thread acu_unique *_acu_stack_ptr, *_acu_latest;
+/* By default, the cleanup stack is a doubly linked list of nodes allocated from a per-thread slab, kept ordered
+ * by scope depth, so that scopes only need to memorize their depth at entry. Defining ACU_ARRAY_STACK before
+ * including any of the related headers selects an alternative representation: a growable per-thread array of nodes,
+ * where scopes also memorize the array index at their entry. Pushing a node is then a bump of the top index, and
+ * cleanup at the end of a scope is a linear sweep over contiguous memory. The array grows in fixed-size chunks
+ * that are never moved, so acu_unique pointers remain valid. Entering a scope allocates nothing in either case. */
+#ifndef ACU_ARRAY_STACK
+	#define _ACU_ENTER(mark)
+	#define _ACU_MARK 0L
+	#define _acu_cleanup_to(mark, scope) _acu_cleanup(scope)
+	void _acu_cleanup(long);
+#else
+	extern __thread long _acu_top;
+	#define _ACU_ENTER(mark) long mark = _acu_top;
+	#define _ACU_MARK _acu_top
+	#define _acu_cleanup_to(mark, scope) _acu_cleanup(mark, scope)
+	void _acu_cleanup(long, long);
+#endif
+
+/* Base class storing reference to the actual object, and its destructor function */
+struct _acu_node {
+	void *ptr;
+	void (*del)(void *);
+};
+
+/* Class for unique object references. Its layout is public only so that acu_header can be embedded in objects,
+ * the fields may only be accessed by the library. With ACU_ARRAY_STACK the nodes are entries of a per-thread
+ * array, and need no links. Linked nodes carry a creation number for acu_yield, and pack scope depth (limited to
+ * 2^19) and properties into one word, making a node 40 bytes, or 24 bytes as an array entry, on 64-bit targets. */
+struct _acu_stack_node {
+	struct _acu_node base;
+	#ifndef ACU_ARRAY_STACK
+		acu_unique *next, *prev;
+		unsigned seq;
+		signed int scope : 20;
+		unsigned int properties : 12;
+	#else
+		int scope;
+		int properties;
+	#endif
+};
+
+/* Header for embedding the unique node of an object in the object itself, see acu_register_embedded */
+#ifndef ACU_ARRAY_STACK
+	typedef struct _acu_stack_node acu_header;
+#else
+	typedef struct { char unused; } acu_header;
+#endif
+
+extern __thread acu_unique *_acu_latest;
 extern __thread long _acu_scope;
 
+/* Defining ACU_CLEANUP_ATTR (GCC or Clang) implements the scope brackets with a variable whose cleanup attribute
+ * releases the scope, so that the scope is released however it is left: return, break, continue and goto are then
+ * as safe as acu_return, and acu_exit_scope is a jump to the end of the scope, so no scope calls setjmp.
+ * Defining ACU_UNWIND (GCC only, all sources compiled with -fexceptions) implies ACU_CLEANUP_ATTR, and selects
+ * table-driven unwinding: throw unwinds the stack with _Unwind_ForcedUnwind, which runs those cleanups frame by
+ * frame. Entering a TRY block then saves no context with setjmp either, at the cost of a slower throw.
+ * See exception.h. */
+#if defined(ACU_UNWIND) && !defined(ACU_CLEANUP_ATTR)
+	#define ACU_CLEANUP_ATTR
+#endif
+#ifdef ACU_CLEANUP_ATTR
+	#ifndef __GNUC__
+		#error "ACU_CLEANUP_ATTR requires GCC or Clang"
+	#endif
+	struct _acu_frame {
+		long mark;
+		long scope;
+	};
+	/* Cleanup function of the variable declared by the scope brackets, run however the scope is left */
+	static inline void _acu_leave(struct _acu_frame *f) { _acu_scope = f->scope; _acu_cleanup_to(f->mark, f->scope); }
+	#define _ACU_FRAME(f) struct _acu_frame f __attribute__((cleanup(_acu_leave))) = {_ACU_MARK, _acu_scope++};
+#endif
+#ifdef ACU_UNWIND
+	#if !defined(__GNUC__) || defined(__clang__)
+		#error "ACU_UNWIND requires GCC"
+	#endif
+	#ifndef __EXCEPTIONS
+		#error "ACU_UNWIND requires compiling with -fexceptions"
+	#endif
+#endif
+
+/* Private support of acu_std.c for blocks allocated with their unique node as a prefix of _ACU_PREFIX bytes */
+#define _ACU_PREFIX ((sizeof(acu_unique) + 15) & ~(size_t)15)
+void *_acu_push_prefixed(void *);
+void _acu_free_prefixed(void *);
+void *_acu_realloc(acu_unique *, size_t);
+
+/* Private support of acu_std.c for objects whose destructor uses thread-local state, such as arenas: these are
+ * never destructed on another thread, so acu_defer_destruct, and acu_share and acu_submit_to with ACU_THREAD_SAFE,
+ * throw a name exception for them */
+void _acu_bind_thread(acu_unique *);
+
 /* Private cleanup functions, required in the header because the macros use them */
-void _acu_cleanup(acu_unique *u, acu_unique **tailptr, long);
 void _acu_atexit_cleanup(void);
 #ifdef ACU_THREAD_SAFE
 	void _acu_thread_cleanup(void *);
@@ -82,6 +174,11 @@ void _acu_atexit_cleanup(void);
 /* Create a new unique pointer to object 'ptr' with destructor 'del', return pointer to it */
 acu_unique *acu_new_unique(void *ptr, void (*del)(void *));
 
+/* Create a new unique pointer to object 'ptr' with destructor 'del' that takes 'arg' as its second argument, such
+ * as the length of a mapping for munmap, and return pointer to it. The argument is stored with the node, so that
+ * needs no allocation of its own. */
+acu_unique *acu_new_unique_arg(void *ptr, uintptr_t arg, void (*del)(void *, uintptr_t));
+
 /* Get pointer to the latest unique node. Will throw an exception if
  * 1) no unique nodes have been created within the same function, or
  * 2) no unique nodes have been created after last call to acu_latest(), acu_share(), acu_destruct() or acu_submit_to(). */
@@ -91,23 +188,48 @@ acu_unique *acu_latest(void);
  * suc as locks as early as possible. */
 void acu_destruct(acu_unique *u);
 
-/* Update the pointer to an object, he only motivation for having this is realloc */
+/* Update the pointer to an object, the only motivation for having this is realloc of a block from malloc. Blocks
+ * from acu_malloc, acu_calloc and acu_strdup are not malloc pointers and must be resized with acu_realloc instead;
+ * a pointer installed over one of them with acu_update must come from malloc, and is released with free. */
 void acu_update(acu_unique *u, void *p);
 
 /* Detach unique pointer 'u' from the cleanup stack and push a copy of it to cleanup stack of shared pointer 's'. */
 void acu_submit_to(acu_unique *u, acu_shared *s);
 
+/* Push the unique node embedded in an object as header 'h' to the cleanup stack, with destructor 'del' that is
+ * passed 'h' when called, and return pointer to it. The node needs no allocation of its own, and shares the cache
+ * lines of the object. Placing 'h' first in the object lets 'del' cast it to the object. The node is unlinked from
+ * the stack before 'del' is called, so 'del' may free the object. The node lives and dies with the object, so it
+ * can't take another object: acu_swap and acu_share on it, and acu_transfer to it, throw a name exception, while
+ * transferring or submitting its object elsewhere unlinks it first. With ACU_ARRAY_STACK, where pushing a node
+ * allocates nothing anyway, 'h' is unused and an entry of the array is returned. */
+acu_unique *acu_register_embedded(acu_header *h, void (*del)(void *));
+
+/* Call fn(arg) at the end of the current scope, in LIFO order with the destructors of the objects of the scope, as
+ * with a unique pointer to 'arg' with destructor 'fn'. The record is a node from the per-thread slab, or an entry of
+ * the array, which are recycled and reach the heap only to grow. It has no handle, so it can't be destructed early,
+ * passed to another scope or shared, and acu_latest() throws after this. If there's no memory for the record, fn(arg)
+ * is called at once, and a memory exception thrown. */
+void acu_defer(void (*fn)(void *), void *arg);
+
 /* Create an empty unique node (for receiving ownership by acu_transfer) and return pointer to it */
 acu_unique *acu_reserve(void);
 
 /* Create a shared pointer pointing to the same object unique pointer 'u' points to. Turn 'u' into a forward reference to the
- * shared node. Set reference count of the shared node to 1. Return pointer to the acu_shared object. */
+ * shared node. Set reference count of the shared node to 1. Return pointer to the acu_shared object.
+ * With ACU_THREAD_SAFE, the reference counts are biased to the calling thread, which updates them without atomic
+ * operations until a reference is handed off. Another thread may therefore use the shared node only through a
+ * reference it has received by acu_transfer, acu_swap, acu_share or acu_submit_to (followed by a synchronizing
+ * signal, such as a semaphore or a barrier), never through a pointer to the node that was merely passed to it. */
 acu_shared *acu_share(acu_unique *u);
 
-/* Create new acu_unique object pointing to shared node 's'. Increase reference count of 's' by one, and increase weak reference count if reference count was zero. */
+/* Create new acu_unique object pointing to shared node 's'. Increase reference count of 's' by one, and increase weak reference count if reference count was zero.
+ * The calling thread must hold a reference to 's' obtained as described at acu_share. */
 acu_unique *acu_new_reference(acu_shared *s);
 
-/* Copy unique object reference from 'from' to 'to', and unlink unique pointer 'from'. This can be used to transfer ownership of unique node to an outer scope. */
+/* Copy unique object reference from 'from' to 'to', and unlink unique pointer 'from'. This can be used to transfer ownership of unique node to an outer scope.
+ * It is also how a reference to a shared node is handed off to another thread, with 'to' reserved by the receiving
+ * thread: see acu_share. */
 void acu_transfer(acu_unique *from, acu_unique *to);
 
 /* Pass unique pointer to the enclosing dynamic scope (e.g., the calling function) */
@@ -125,26 +247,95 @@ acu_unique *acu_new_weak_reference(acu_shared *s);
 /* Obtain a strong reference to a shared pointer from a weak reference. If the object is already destructed, return NULL. */
 acu_unique *acu_lock_reference(acu_unique *weakptr);
 
+/* Register 'bulk' as the bulk version of destructor 'del': cleanup then passes the object pointers of runs of
+ * consecutive nodes with destructor 'del' to a single call of 'bulk', in the order 'del' would have been called
+ * for them, instead of calling 'del' for each. free is registered by default. Passing NULL as 'bulk' disables
+ * batching for 'del'. Return 0, or -1 if the table of bulk destructors is full. The table is shared by all
+ * threads, so register before starting other threads using autocleanup. */
+int acu_register_bulk(void (*del)(void *), void (*bulk)(void **ptrs, int n));
+
+#ifdef ACU_THREAD_SAFE
+	/* Mark unique pointer 'u' deferrable: when cleanup at the end of its scope reaches it, the object and its
+	 * destructor are queued to a background reaper thread, started by the first call, instead of being destructed
+	 * inline. Use this for expensive destructors such as fclose of a large buffer or munmap of a big region. Locks
+	 * and references to shared pointers may not be deferred; this throws a name exception for them, and cleanup
+	 * destructs them inline if 'u' later becomes one (acu_share). acu_destruct always destructs inline.
+	 * Ordering: non-deferred objects of a scope are destructed before its end is passed, as before, whereas
+	 * deferred objects are destructed at some later point on the reaper, concurrently with the rest of the
+	 * program. So a deferred object must not depend on anything destructed inline, nor on the calling thread:
+	 * its destructor must not touch thread-local state, which on the reaper is the reaper's own. Objects whose
+	 * destructor does, like arenas (acu_arena), are rejected with a name exception.
+	 * Deferred objects are destructed one at a time in the order they were queued, which for the objects of one
+	 * thread is the order inline cleanup would have destructed them in. A destructor run by the reaper must not
+	 * throw. */
+	void acu_defer_destruct(acu_unique *u);
+
+	/* Wait until the reaper has destructed all objects queued before the call. Registered with atexit when the
+	 * reaper is started, and also called by the cleanup registered by acu_init. */
+	void acu_drain_deferred(void);
+#endif
+
+/* Counters of the per-thread slab from which unique nodes are allocated (all zero with ACU_ARRAY_STACK) */
+struct acu_slab_stats {
+	unsigned long allocs;	/* nodes handed out */
+	unsigned long reuses;	/* nodes handed out from the freelist of released nodes */
+	unsigned long chunks;	/* chunks obtained from malloc */
+	unsigned long live;	/* nodes currently in use */
+};
+
+/* Copy the slab counters of the calling thread to *st */
+void acu_get_slab_stats(struct acu_slab_stats *st);
+
 
 #define acu_init atexit(_acu_atexit_cleanup);
 #ifdef ACU_THREAD_SAFE
 	#define acu_init_thread phthread_cleanup_push(_acu_thread_cleanup, NULL);
 #endif
 
-#define BEGIN { acu_unique *_acu_stack_ptr_scope = acu_reserve(), *_acu_stack_ptr_fn = _acu_stack_ptr_scope; _acu_latest = NULL; \
-		long _acu_current_scope = _acu_scope++;
-#define BEGIN_SCOPE { acu_unique *_acu_stack_ptr_scope = acu_reserve(); jmp_buf _acu_scope_context; long _acu_current_scope = _acu_scope++; \
-		if (setjmp(_acu_scope_context) == 0) {
+#ifndef ACU_CLEANUP_ATTR
+	#define BEGIN { _ACU_ENTER(_acu_stack_mark_fn) long _acu_function_scope = _acu_scope++; _acu_latest = NULL;
+	#define BEGIN_SCOPE { _ACU_ENTER(_acu_stack_mark_scope) jmp_buf _acu_scope_context; long _acu_current_scope = _acu_scope++; \
+			if (setjmp(_acu_scope_context) == 0) {
+
+	/* BEGIN_BLOCK..END_BLOCK is an inner scope that cannot be left using acu_exit_scope, and therefore does not need
+	 * to save a context using setjmp at entry */
+	#define BEGIN_BLOCK { _ACU_ENTER(_acu_stack_mark_scope) long _acu_current_scope = _acu_scope++; {
 
-#define END_SCOPE } _acu_scope = _acu_current_scope; _acu_cleanup(_acu_stack_ptr_scope, &_acu_stack_ptr, _acu_current_scope); }
-#define END _acu_scope = _acu_current_scope; _acu_cleanup(_acu_stack_ptr_fn, &_acu_stack_ptr, _acu_current_scope); }
+	#define END_SCOPE } _acu_scope = _acu_current_scope; _acu_cleanup_to(_acu_stack_mark_scope, _acu_current_scope); }
+	#define END_BLOCK END_SCOPE
+	#define END _acu_scope = _acu_function_scope; _acu_cleanup_to(_acu_stack_mark_fn, _acu_function_scope); }
 
-#define acu_exit_scope longjmp(_acu_scope_context, 1)
-#define acu_exit(v) { _acu_cleanup(NULL, &_acu_stack_ptr, 0); exit(v); }
+	#define acu_exit_scope longjmp(_acu_scope_context, 1)
 
-/* This is designed to be usable in any context plain return can be used. Uses "while" instead of "if",
- * because "if" would break things if there's an "else" right after acu_return. */
-#define acu_return while (_acu_scope = _acu_current_scope, _acu_cleanup(_acu_stack_ptr_fn, &_acu_stack_ptr, _acu_current_scope), 1) return
+	/* This is designed to be usable in any context plain return can be used. Uses "while" instead of "if",
+	 * because "if" would break things if there's an "else" right after acu_return. */
+	#define acu_return while (_acu_scope = _acu_function_scope, _acu_cleanup_to(_acu_stack_mark_fn, _acu_function_scope), 1) return
+#else
+	/* The cleanup attribute releases the scope however it is left, and acu_exit_scope is a jump to its end */
+	#define BEGIN { _ACU_FRAME(_acu_frame_fn) _acu_latest = NULL;
+	#define BEGIN_SCOPE { __label__ _acu_scope_end; _ACU_FRAME(_acu_frame_scope) {
+	#define BEGIN_BLOCK BEGIN_SCOPE
+	#define END_SCOPE } _acu_scope_end: __attribute__((unused)); }
+	#define END_BLOCK END_SCOPE
+	#define END }
 
+	#define acu_exit_scope goto _acu_scope_end
+	#define acu_return return
 #endif
 
+#define acu_exit(v) { _acu_cleanup_to(0, 0); exit(v); }
+
+/* Generate typed functions for objects of type 'type' with destructor 'dtor', void dtor(type *), named after 'name':
+ *   type *acu_new_name(type *p): create a unique pointer to 'p', and return 'p' (see acu_latest())
+ *   type *acu_get_name(acu_unique *u): as acu_get_ptr(u), but inline and without a call if 'u' was created by
+ *     acu_new_name, i.e. unless it has been shared, swapped or transferred
+ *   void _acu_del_name(void *p): destructor calling 'dtor', which the compiler can inline into it.
+ * Expand at file scope of each translation unit using them. The functions are static, so a unique pointer created in
+ * another translation unit is handled by the untyped path of acu_get_name. The untyped functions work on all of them. */
+#define ACU_DECLARE_TYPE(name, type, dtor) \
+	static void _acu_del_##name(void *p) { dtor((type *)p); } \
+	static inline type *acu_new_##name(type *p) { (void)acu_new_unique(p, _acu_del_##name); return p; } \
+	static inline type *acu_get_##name(acu_unique *u) \
+		{ return u->base.del == _acu_del_##name ? (type *)u->base.ptr : (type *)acu_get_ptr(u); }
+
+#endif
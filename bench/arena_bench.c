@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../acu_std.h"
+
+/* Microbenchmark for a scope making a couple of hundred small allocations with acu_malloc_t, with each
+ * allocation on the heap with a unique node of its own, and with all of them in an arena.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/arena_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o arena_bench */
+
+#define ITERATIONS 100000L
+#define ALLOCS 200
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static void heap_fn(void)
+BEGIN
+	int i;
+	for (i = 0; i < ALLOCS; i++) memset(acu_malloc_t(16 + i % 64), 0, 16);
+END
+
+__attribute__((noinline)) static void arena_fn(void)
+BEGIN
+	int i;
+	acu_arena_t(0);
+	for (i = 0; i < ALLOCS; i++) memset(acu_malloc_t(16 + i % 64), 0, 16);
+END
+
+static void report(const char *what, double t0, double t1)
+{
+	printf("%-24s %8.1f ns per scope\n", what, (t1 - t0) / ITERATIONS);
+}
+
+int main(void)
+BEGIN
+	long i;
+	double t0, t1;
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++) heap_fn();
+	t1 = now();
+	report("heap", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++) arena_fn();
+	t1 = now();
+	report("arena", t0, t1);
+
+	acu_return 0;
+END
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../acu_std.h"
+
+/* Microbenchmark for the end of a scope releasing a run of nodes with the same destructor, one destructor
+ * call per node versus batches passed to a bulk destructor: blocks from acu_malloc_t released by free, and
+ * descriptors from acu_open_t released by close or close_range.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/cleanup_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o cleanup_bench
+ * and add -DACU_ARRAY_STACK to measure the array-backed stack. */
+
+#define ITERATIONS 20000L
+#define NODES 200
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static void malloc_fn(void)
+BEGIN
+	int i;
+	for (i = 0; i < NODES; i++) memset(acu_malloc_t(16 + i % 64), 0, 16);
+END
+
+__attribute__((noinline)) static void open_fn(void)
+BEGIN
+	int i;
+	for (i = 0; i < NODES; i++) acu_open_t("/dev/null", O_RDONLY);
+END
+
+static void free_bulk(void **ptrs, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) free(ptrs[i]);
+}
+
+static void report(const char *what, void (*fn)(void))
+{
+	long i;
+	double t0 = now();
+	for (i = 0; i < ITERATIONS; i++) fn();
+	printf("%-24s %8.1f ns per scope\n", what, (now() - t0) / ITERATIONS);
+}
+
+int main(void)
+BEGIN
+	acu_register_bulk(free, NULL);
+	report("malloc, free per node", malloc_fn);
+	acu_register_bulk(free, free_bulk);
+	report("malloc, bulk free", malloc_fn);
+
+	report("open, close per node", open_fn);
+	acu_register_std_bulk();
+	report("open, close_range", open_fn);
+
+	acu_return 0;
+END
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Microbenchmark for upgrading a weak reference with acu_lock_reference, as a cache lookup does, and dropping the
+ * strong reference again. Measures a live and an expired object, and with ACU_THREAD_SAFE also a live object whose
+ * reference has been handed off, so that its counters are updated atomically.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/lock_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o lock_bench
+ * and add -DACU_THREAD_SAFE -pthread to measure the thread-safe counters. */
+
+#define ITERATIONS 10000000L
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void nop(void *p) { (void)p; }
+
+static void lookup(const char *name, acu_unique *w)
+{
+	long i;
+	double t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		acu_unique *u = acu_lock_reference(w);
+		if (u) acu_destruct(u);
+	}
+	printf("%-18s %6.1f ns per lookup\n", name, (now() - t0) / ITERATIONS);
+}
+
+int main(void)
+BEGIN
+	acu_unique *u = acu_new_unique(NULL, nop);
+	acu_shared *s = acu_share(u);
+	acu_unique *w = acu_new_weak_reference(s);
+	lookup("live:", w);
+	#ifdef ACU_THREAD_SAFE
+		acu_unique *h = acu_new_unique(NULL, NULL);
+		acu_transfer(u, h);
+		u = h;
+		lookup("live, handed off:", w);
+	#endif
+	acu_destruct(u);
+	lookup("expired:", w);
+	acu_return 0;
+END
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Benchmark for the memory taken by unique nodes: the size of a node, and the growth of the resident set size
+ * and the time per node when a scope holds NODES live nodes at once.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/node_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o node_bench
+ * and add -DACU_ARRAY_STACK to measure the array-backed stack. */
+
+#define NODES 1000000L
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Resident set size of the process in kB */
+static long rss(void)
+{
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f)
+	{
+		if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+		fclose(f);
+	}
+	return resident * 4;
+}
+
+static void nop(void *p) { (void)p; }
+
+int main(void)
+BEGIN
+	long i, r0 = rss();
+	double t0 = now(), t1;
+	printf("sizeof(acu_unique) %zu bytes\n", sizeof(acu_unique));
+	BEGIN_BLOCK
+		for (i = 0; i < NODES; i++) (void)acu_new_unique((void *)i, nop);
+		t1 = now();
+		printf("%ld live nodes: %ld kB resident, %.1f bytes per node\n", NODES, rss() - r0, (rss() - r0) * 1024.0 / NODES);
+	END_BLOCK
+	printf("push %.1f ns, cleanup %.1f ns per node\n", (t1 - t0) / NODES, (now() - t1) / NODES);
+	acu_return 0;
+END
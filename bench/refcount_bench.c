@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Benchmark for threads taking and dropping strong references to one hot shared object with acu_new_reference and
+ * acu_destruct. First the thread that shared the object does REFS pairs, then from 1 to MAX_THREADS threads each
+ * receive a reference of their own and do REFS pairs. Reports the wall time per pair over all threads.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 -DACU_THREAD_SAFE -pthread bench/refcount_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o refcount_bench */
+
+#ifndef ACU_THREAD_SAFE
+	#error "build with -DACU_THREAD_SAFE -pthread"
+#endif
+
+#define REFS 2000000L
+#define MAX_THREADS 8
+
+static pthread_barrier_t ready, start;
+
+/* A worker reserves 'slot' in its own stack, into which the main thread transfers its reference */
+struct worker {
+	pthread_t tid;
+	acu_shared *s;
+	acu_unique *slot;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void nop(void *p) { (void)p; }
+
+static void *worker(void *arg)
+BEGIN
+	struct worker *w = arg;
+	long i;
+	w->slot = acu_reserve();
+	pthread_barrier_wait(&ready);
+	pthread_barrier_wait(&start);
+	for (i = 0; i < REFS; i++) acu_destruct(acu_new_reference(w->s));
+	acu_return NULL;
+END
+
+int main(void)
+BEGIN
+	int n, i;
+	long j;
+	acu_unique *u = acu_new_unique(NULL, nop);
+	acu_shared *s = acu_share(u);
+	double t0 = now();
+	for (j = 0; j < REFS; j++) acu_destruct(acu_new_reference(s));
+	printf("owner:     %6.1f ns per reference\n", (now() - t0) / REFS);
+	for (n = 1; n <= MAX_THREADS; n *= 2)
+	{
+		struct worker w[MAX_THREADS];
+		pthread_barrier_init(&ready, NULL, n + 1);
+		pthread_barrier_init(&start, NULL, n + 1);
+		for (i = 0; i < n; i++)
+		{
+			w[i].s = s;
+			pthread_create(&w[i].tid, NULL, worker, &w[i]);
+		}
+		pthread_barrier_wait(&ready);
+		for (i = 0; i < n; i++) acu_transfer(acu_new_reference(s), w[i].slot);
+		pthread_barrier_wait(&start);
+		t0 = now();
+		for (i = 0; i < n; i++) pthread_join(w[i].tid, NULL);
+		printf("%d threads: %6.1f ns per reference\n", n, (now() - t0) / (n * REFS));
+		pthread_barrier_destroy(&ready);
+		pthread_barrier_destroy(&start);
+	}
+	acu_return 0;
+END
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Microbenchmark for the fixed cost of entering and leaving an empty scope.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/scope_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o scope_bench
+ * and add -DACU_ARRAY_STACK to measure the array-backed stack, -DACU_CLEANUP_ATTR for scopes based on the
+ * cleanup attribute, or -DACU_UNWIND -fexceptions for the unwinding mode. */
+
+#define ITERATIONS 10000000L
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static void plain_fn(void)
+{
+	__asm__ volatile("");
+}
+
+__attribute__((noinline)) static void begin_end_fn(void)
+BEGIN
+	__asm__ volatile("");
+END
+
+static void report(const char *what, double t0, double t1)
+{
+	printf("%-24s %6.2f ns\n", what, (t1 - t0) / ITERATIONS);
+}
+
+int main(void)
+BEGIN
+	long i;
+	double t0, t1;
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++) plain_fn();
+	t1 = now();
+	report("plain call", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++) begin_end_fn();
+	t1 = now();
+	report("BEGIN..END call", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		BEGIN_SCOPE
+			__asm__ volatile("");
+		END_SCOPE
+	}
+	t1 = now();
+	report("BEGIN_SCOPE..END_SCOPE", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		BEGIN_BLOCK
+			__asm__ volatile("");
+		END_BLOCK
+	}
+	t1 = now();
+	report("BEGIN_BLOCK..END_BLOCK", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		TRY
+			__asm__ volatile("");
+		CATCH(e)
+			(void)e;
+		TRY_END
+	}
+	t1 = now();
+	report("TRY..TRY_END", t0, t1);
+
+	acu_return 0;
+END
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Benchmark for threads submitting sub-resources to one shared aggregate with acu_submit_to, from 1 to MAX_THREADS
+ * threads, each submitting SUBMITS nodes. Reports the wall time per submission over all threads.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 -DACU_THREAD_SAFE -pthread bench/submit_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o submit_bench */
+
+#ifndef ACU_THREAD_SAFE
+	#error "build with -DACU_THREAD_SAFE -pthread"
+#endif
+
+#define SUBMITS 200000L
+#define MAX_THREADS 8
+
+static pthread_barrier_t start;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void nop(void *p) { (void)p; }
+
+static void *worker(void *s)
+BEGIN
+	long i;
+	pthread_barrier_wait(&start);
+	for (i = 0; i < SUBMITS; i++) acu_submit_to(acu_new_unique((void *)i, nop), s);
+	acu_return NULL;
+END
+
+int main(void)
+BEGIN
+	int n, i;
+	for (n = 1; n <= MAX_THREADS; n *= 2)
+	BEGIN_BLOCK
+		pthread_t tid[MAX_THREADS];
+		acu_shared *s = acu_share(acu_new_unique(NULL, nop));
+		(void)acu_new_reference(s);
+		pthread_barrier_init(&start, NULL, n + 1);
+		for (i = 0; i < n; i++) pthread_create(&tid[i], NULL, worker, s);
+		pthread_barrier_wait(&start);
+		double t0 = now();
+		for (i = 0; i < n; i++) pthread_join(tid[i], NULL);
+		printf("%d threads: %6.1f ns per submission\n", n, (now() - t0) / (n * SUBMITS));
+		pthread_barrier_destroy(&start);
+	END_BLOCK
+	acu_return 0;
+END
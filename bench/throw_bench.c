@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+
+/* Microbenchmark for throwing through a chain of frames that each have a TRY, only the outermost of which
+ * handles the exception: with catch-all clauses that rethrow, and with typed clauses that throw skips.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/throw_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o throw_bench
+ * and add -DACU_UNWIND -fexceptions to measure the unwinding mode. */
+
+#define ITERATIONS 200000L
+#define DEPTH 16
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static void rethrow_fn(int d)
+BEGIN
+	if (d == 0) throw(new_fail_exception("rethrow_fn", -1));
+	TRY
+		rethrow_fn(d - 1);
+	CATCH(e)
+		if (io_exception(e) == NULL) rethrow;
+	TRY_END
+END
+
+__attribute__((noinline)) static void typed_fn(int d)
+BEGIN
+	if (d == 0) throw(new_fail_exception("typed_fn", -1));
+	TRY
+		typed_fn(d - 1);
+	CATCH_TYPE(e, EXCTYPE_IO)
+		(void)e;
+	TRY_END
+END
+
+static void report(const char *what, double t0, double t1)
+{
+	printf("%-28s %8.1f ns\n", what, (t1 - t0) / ITERATIONS);
+}
+
+int main(void)
+BEGIN
+	long i;
+	double t0, t1;
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		TRY
+			rethrow_fn(DEPTH);
+		CATCH_TYPE(e, EXCTYPE_FAIL)
+			(void)e;
+		TRY_END
+	}
+	t1 = now();
+	report("CATCH and rethrow", t0, t1);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		TRY
+			typed_fn(DEPTH);
+		CATCH_TYPE(e, EXCTYPE_FAIL)
+			(void)e;
+		TRY_END
+	}
+	t1 = now();
+	report("CATCH_TYPE, skipped frames", t0, t1);
+
+	acu_return 0;
+END
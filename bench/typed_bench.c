@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Microbenchmark for accessing objects through unique pointers, with the untyped acu_get_ptr and with the inline
+ * getter generated by ACU_DECLARE_TYPE, and for creating and releasing them with each.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/typed_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o typed_bench */
+
+#define ITERATIONS 10000000L
+#define NODES 16
+
+struct buf {
+	long len;
+	char data[48];
+};
+
+static void buf_free(struct buf *b) { free(b); }
+
+ACU_DECLARE_TYPE(buf, struct buf, buf_free)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static long get_untyped(acu_unique **u)
+{
+	long i, s = 0;
+	for (i = 0; i < ITERATIONS; i++) s += ((struct buf *)acu_get_ptr(u[i % NODES]))->len;
+	return s;
+}
+
+__attribute__((noinline)) static long get_typed(acu_unique **u)
+{
+	long i, s = 0;
+	for (i = 0; i < ITERATIONS; i++) s += acu_get_buf(u[i % NODES])->len;
+	return s;
+}
+
+__attribute__((noinline)) static void new_untyped(void)
+BEGIN
+	int i;
+	for (i = 0; i < NODES; i++) (void)acu_new_unique(malloc(sizeof(struct buf)), (void (*)(void *))buf_free);
+END
+
+__attribute__((noinline)) static void new_typed(void)
+BEGIN
+	int i;
+	for (i = 0; i < NODES; i++) (void)acu_new_buf(malloc(sizeof(struct buf)));
+END
+
+static void report(const char *what, double t, long n)
+{
+	printf("%-20s %6.2f ns\n", what, t / n);
+}
+
+int main(void)
+BEGIN
+	acu_unique *u[NODES];
+	long i, s;
+	double t0;
+	for (i = 0; i < NODES; i++)
+	{
+		acu_new_buf(calloc(1, sizeof(struct buf)))->len = i;
+		u[i] = acu_latest();
+	}
+
+	t0 = now();
+	s = get_untyped(u);
+	report("acu_get_ptr", now() - t0, ITERATIONS);
+	t0 = now();
+	s -= get_typed(u);
+	report("acu_get_buf", now() - t0, ITERATIONS);
+
+	t0 = now();
+	for (i = 0; i < ITERATIONS / NODES; i++) new_untyped();
+	report("new+cleanup untyped", now() - t0, ITERATIONS);
+	t0 = now();
+	for (i = 0; i < ITERATIONS / NODES; i++) new_typed();
+	report("new+cleanup typed", now() - t0, ITERATIONS);
+	acu_return s != 0;
+END
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../acu_std.h"
+
+/* Microbenchmark for passing a large number of objects up through several function levels with acu_yield:
+ * the innermost function allocates NODES objects, and every level yields all of them to its caller, either
+ * in the order they were created or newest first.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -O2 bench/yield_bench.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o yield_bench
+ * and add -DACU_ARRAY_STACK to measure the array-backed stack. */
+
+#define ITERATIONS 20
+#define NODES 10000
+#define LEVELS 4
+
+static acu_unique *nodes[NODES];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void yield_all(int newest_first)
+{
+	int i;
+	for (i = 0; i < NODES; i++) acu_yield(nodes[newest_first ? NODES - 1 - i : i]);
+}
+
+__attribute__((noinline)) static void level(int depth, int newest_first)
+BEGIN
+	int i;
+	if (depth == LEVELS)
+		for (i = 0; i < NODES; i++)
+		{
+			(void)acu_malloc_t(16);
+			nodes[i] = acu_latest();
+		}
+	else level(depth + 1, newest_first);
+	yield_all(newest_first);
+END
+
+static void report(const char *what, int newest_first)
+{
+	int i;
+	double t = 0;
+	for (i = 0; i < ITERATIONS; i++)
+	BEGIN
+		double t0 = now();
+		level(1, newest_first);
+		t += now() - t0;
+	END
+	printf("%-16s %8.1f ns per node and level\n", what, t / ITERATIONS / NODES / LEVELS);
+}
+
+int main(void)
+BEGIN
+	report("creation order", 0);
+	report("newest first", 1);
+	acu_return 0;
+END
@@ -96,11 +96,10 @@ BEGIN
 		s = g(x, r);
 		printf("Function g returned %s\n", s);
 		printf("Got handle to shared string %s\n", (char *)acu_get_ptr(q));
-	CATCH(e)
+	CATCH_TYPE(e, EXCTYPE_NAME)
+		/* Other exceptions pass through h without entering this block */
 		printf("Enter catch block of h\n");
-		struct name_exception *n = name_exception(e);
-		if (n) printf("Caught name exception: %s\n", n->name);
-		else rethrow;
+		printf("Caught name exception: %s\n", name_exception(e)->name);
 	TRY_END
 	printf(".exit h\n");
 	acu_return s;
@@ -1,198 +1,177 @@
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "exception.h"
 #include "exc_classes.h"
 
-static void _exc_to_str_nomem(char *buf, int n) { (void)snprintf(buf, n, "Out of heap memory"); }
-static void _exc_del_nomem(struct exception *e) { return; }
-struct exception _exc_sys_nomem_g = {EXCTYPE_NOMEM, _exc_to_str_nomem, _exc_del_nomem, "", 0};
-
-
-/* Exception type specific functions: each type t requires four functions defined here
- * - _exc_to_str_<t>(char *buf, int n)		// Create string description of the exception to buffer buf
- * - _exc_del_<t>(struct exception *e)		// Destructor for exception e
+/* Abstract base classes, which are not thrown as such but can be tested for with exc_is_a */
+const struct exc_class exc_resource_class = {"resource_exception", sizeof(struct exception), NULL, NULL,
+	EXCTYPE_ANY, 1, {EXCTYPE_ANY, EXCTYPE_RESOURCE}};
+const struct exc_class exc_memory_class = {"memory_exception", sizeof(struct exception), NULL, NULL,
+	EXCTYPE_RESOURCE, 2, {EXCTYPE_ANY, EXCTYPE_RESOURCE, EXCTYPE_MEMORY}};
+const struct exc_class exc_call_class = {"call_exception", sizeof(struct exception), NULL, NULL,
+	EXCTYPE_ANY, 1, {EXCTYPE_ANY, EXCTYPE_CALL}};
+const struct exc_class exc_usage_class = {"usage_exception", sizeof(struct exception), NULL, NULL,
+	EXCTYPE_ANY, 1, {EXCTYPE_ANY, EXCTYPE_USAGE}};
+
+static void _exc_to_str_nomem(const struct exception *e, char *buf, int n) { (void)snprintf(buf, n, "Out of heap memory"); }
+const struct exc_class exc_nomem_class = {"nomem_exception", sizeof(struct exception), _exc_to_str_nomem, NULL,
+	EXCTYPE_MEMORY, 3, {EXCTYPE_ANY, EXCTYPE_RESOURCE, EXCTYPE_MEMORY, EXCTYPE_NOMEM}};
+struct exception _exc_sys_nomem_g = {EXCTYPE_NOMEM, _EXC_STATIC, {0, 0}, "", 0};
+
+
+/* Exception type specific definitions: each type t requires the following defined here
+ * - _exc_to_str_<t>(e, char *buf, int n)	// Create string description of exception e to buffer buf
+ * - exc_<t>_class				// Class descriptor, EXCTYPE_<T> in exc_classes.h points to it
  * - new_<t>_exception(...)			// Create exception of type <t>, arguments are type-dependent
- * - <t>_exception(e)				// Return correctly casted pointer to e, or NULL if not correct type
- * and in exception.h, struct <t>_exception */
+ * - <t>_exception(e)				// Return correctly casted pointer to e, or NULL if not of type <t>
+ *						// or a type derived from it
+ * and in exc_classes.h, struct <t>_exception. Exceptions are allocated using _exc_alloc, which copies up to two
+ * string arguments next to the object, so that no argument needs to outlive the constructor call. Types that own
+ * other resources can set a destructor _exc_del_<t>(struct exception *e) in their class. */
 
 /* NAME */
-static void _exc_to_str_name(char *buf, int n)
+static void _exc_to_str_name(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "name_exception: '%s'", name_exception(_exception_ptr)->name);
+	const struct name_exception *x = (const struct name_exception *)e;
+	snprintf(buf, n, "name_exception: '%s'", x->name);
 }
 
-static void _exc_del_name(struct exception *e)
-{
-	struct name_exception *dd = name_exception(e);
-	if (dd == NULL) return;
-	if (dd->name) free(dd->name);
-}
+const struct exc_class exc_name_class = {"name_exception", sizeof(struct name_exception), _exc_to_str_name, NULL,
+	EXCTYPE_ANY, 1, {EXCTYPE_ANY, EXCTYPE_NAME}};
 
 struct exception *new_name_exception(const char *name)
 {
-	struct name_exception *e = malloc(sizeof(struct name_exception));
+	struct name_exception *e = _exc_alloc(EXCTYPE_NAME, name, offsetof(struct name_exception, name), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
-	e->name = strdup(name);	// use strdup_t instead
-	_init_exception(&(e->e), EXCTYPE_NAME, _exc_to_str_name, _exc_del_name);
 	return &(e->e);
 }
 
-struct name_exception *name_exception(struct exception *e) { return (struct name_exception *)(e->type == EXCTYPE_NAME ? e : NULL); }
+struct name_exception *name_exception(struct exception *e) { return (struct name_exception *)(exc_is_a(e, EXCTYPE_NAME) ? e : NULL); }
 
 /* IO */
-static void _exc_to_str_io(char *buf, int n)
+static void _exc_to_str_io(const struct exception *e, char *buf, int n)
 {
+	const struct io_exception *x = (const struct io_exception *)e;
 	snprintf(buf, n, "io_exception: errno=%d, function '%s', filename '%s'",
-		io_exception(_exception_ptr)->err,
-		io_exception(_exception_ptr)->function,
-		io_exception(_exception_ptr)->filename
+		x->err,
+		x->function,
+		x->filename
 	);	
 }
 
-static void _exc_del_io(struct exception *e)
-{
-	struct io_exception *dd = io_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-	if (dd->filename) free(dd->filename);
-}
+const struct exc_class exc_io_class = {"io_exception", sizeof(struct io_exception), _exc_to_str_io, NULL,
+	EXCTYPE_RESOURCE, 2, {EXCTYPE_ANY, EXCTYPE_RESOURCE, EXCTYPE_IO}};
 
 struct exception *new_io_exception(int err, const char *filename, const char *function)
 {
-	struct io_exception *e = malloc(sizeof(struct io_exception));
+	struct io_exception *e = _exc_alloc(EXCTYPE_IO, filename, offsetof(struct io_exception, filename),
+		function, offsetof(struct io_exception, function));
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
 	e->err = err;
-	e->filename = strdup(filename);	// use strdup_t instead
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_IO, _exc_to_str_io, _exc_del_io);
 	return &(e->e);
 }
 
-struct io_exception *io_exception(struct exception *e) { return (struct io_exception *)(e->type == EXCTYPE_IO ? e : NULL); }
+struct io_exception *io_exception(struct exception *e) { return (struct io_exception *)(exc_is_a(e, EXCTYPE_IO) ? e : NULL); }
 
 /* MEM */
-static void _exc_to_str_mem(char *buf, int n)
+static void _exc_to_str_mem(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "mem_exception: function '%s', size %ld", mem_exception(_exception_ptr)->function, mem_exception(_exception_ptr)->size);
+	const struct mem_exception *x = (const struct mem_exception *)e;
+	snprintf(buf, n, "mem_exception: function '%s', size %ld", x->function, x->size);
 }
 
-static void _exc_del_mem(struct exception *e)
-{
-	struct mem_exception *dd = mem_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-}
+const struct exc_class exc_mem_class = {"mem_exception", sizeof(struct mem_exception), _exc_to_str_mem, NULL,
+	EXCTYPE_MEMORY, 3, {EXCTYPE_ANY, EXCTYPE_RESOURCE, EXCTYPE_MEMORY, EXCTYPE_MEM}};
 
 struct exception *new_mem_exception(const char *function, long size)
 {
-	struct mem_exception *e = malloc(sizeof(struct mem_exception));
+	struct mem_exception *e = _exc_alloc(EXCTYPE_MEM, function, offsetof(struct mem_exception, function), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
 	e->size = size;
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_MEM, _exc_to_str_mem, _exc_del_mem);
 	return &(e->e);
 }
 
-struct mem_exception *mem_exception(struct exception *e) { return (struct mem_exception *)(e->type == EXCTYPE_MEM ? e : NULL); }
+struct mem_exception *mem_exception(struct exception *e) { return (struct mem_exception *)(exc_is_a(e, EXCTYPE_MEM) ? e : NULL); }
 
 
 /* TRUNC */
-static void _exc_to_str_trunc(char *buf, int n)
+static void _exc_to_str_trunc(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "trunc_exception: function '%s', bufsize %ld", trunc_exception(_exception_ptr)->function, trunc_exception(_exception_ptr)->bufsize);
+	const struct trunc_exception *x = (const struct trunc_exception *)e;
+	snprintf(buf, n, "trunc_exception: function '%s', bufsize %ld", x->function, x->bufsize);
 }
 
-static void _exc_del_trunc(struct exception *e)
-{
-	struct trunc_exception *dd = trunc_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-}
+const struct exc_class exc_trunc_class = {"trunc_exception", sizeof(struct trunc_exception), _exc_to_str_trunc, NULL,
+	EXCTYPE_RESOURCE, 2, {EXCTYPE_ANY, EXCTYPE_RESOURCE, EXCTYPE_TRUNC}};
 
 struct exception *new_trunc_exception(const char *function, long bufsize)
 {
-	struct trunc_exception *e = malloc(sizeof(struct trunc_exception));
+	struct trunc_exception *e = _exc_alloc(EXCTYPE_TRUNC, function, offsetof(struct trunc_exception, function), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
 	e->bufsize = bufsize;
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_TRUNC, _exc_to_str_trunc, _exc_del_trunc);
 	return &(e->e);
 }
 
-struct trunc_exception *trunc_exception(struct exception *e) { return (struct trunc_exception *)(e->type == EXCTYPE_TRUNC ? e : NULL); }
+struct trunc_exception *trunc_exception(struct exception *e) { return (struct trunc_exception *)(exc_is_a(e, EXCTYPE_TRUNC) ? e : NULL); }
 
 /* NULLPTR */
-static void _exc_to_str_nullptr(char *buf, int n)
+static void _exc_to_str_nullptr(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "nullptr_exception: function '%s'", nullptr_exception(_exception_ptr)->function);
+	const struct nullptr_exception *x = (const struct nullptr_exception *)e;
+	snprintf(buf, n, "nullptr_exception: function '%s'", x->function);
 }
 
-static void _exc_del_nullptr(struct exception *e)
-{
-	struct nullptr_exception *dd = nullptr_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-}
+const struct exc_class exc_nullptr_class = {"nullptr_exception", sizeof(struct nullptr_exception), _exc_to_str_nullptr, NULL,
+	EXCTYPE_USAGE, 2, {EXCTYPE_ANY, EXCTYPE_USAGE, EXCTYPE_NULLPTR}};
 
 struct exception *new_nullptr_exception(const char *function)
 {
-	struct nullptr_exception *e = malloc(sizeof(struct nullptr_exception));
+	struct nullptr_exception *e = _exc_alloc(EXCTYPE_NULLPTR, function, offsetof(struct nullptr_exception, function), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_NULLPTR, _exc_to_str_nullptr, _exc_del_nullptr);
 	return &(e->e);
 }
 
-struct nullptr_exception *nullptr_exception(struct exception *e) { return (struct nullptr_exception *)(e->type == EXCTYPE_NULLPTR ? e : NULL); }
+struct nullptr_exception *nullptr_exception(struct exception *e) { return (struct nullptr_exception *)(exc_is_a(e, EXCTYPE_NULLPTR) ? e : NULL); }
 
 /* SIG */
-static void _exc_to_str_sig(char *buf, int n)
+static void _exc_to_str_sig(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "sig_exception: function '%s', signal %d", sig_exception(_exception_ptr)->function, sig_exception(_exception_ptr)->signal);
+	const struct sig_exception *x = (const struct sig_exception *)e;
+	snprintf(buf, n, "sig_exception: function '%s', signal %d", x->function, x->signal);
 }
 
-static void _exc_del_sig(struct exception *e)
-{
-	struct sig_exception *dd = sig_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-}
+const struct exc_class exc_sig_class = {"sig_exception", sizeof(struct sig_exception), _exc_to_str_sig, NULL,
+	EXCTYPE_CALL, 2, {EXCTYPE_ANY, EXCTYPE_CALL, EXCTYPE_SIG}};
 
 struct exception *new_sig_exception(const char *function, int signal)
 {
-	struct sig_exception *e = malloc(sizeof(struct sig_exception));
+	struct sig_exception *e = _exc_alloc(EXCTYPE_SIG, function, offsetof(struct sig_exception, function), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
 	e->signal = signal;
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_SIG, _exc_to_str_sig, _exc_del_sig);
 	return &(e->e);
 }
 
-struct sig_exception *sig_exception(struct exception *e) { return (struct sig_exception *)(e->type == EXCTYPE_SIG ? e : NULL); }
+struct sig_exception *sig_exception(struct exception *e) { return (struct sig_exception *)(exc_is_a(e, EXCTYPE_SIG) ? e : NULL); }
 
 /* FAIL */
-static void _exc_to_str_fail(char *buf, int n)
+static void _exc_to_str_fail(const struct exception *e, char *buf, int n)
 {
-	snprintf(buf, n, "fail_exception: function '%s' returned %d", fail_exception(_exception_ptr)->function, fail_exception(_exception_ptr)->retval);
+	const struct fail_exception *x = (const struct fail_exception *)e;
+	snprintf(buf, n, "fail_exception: function '%s' returned %d", x->function, x->retval);
 }
 
-static void _exc_del_fail(struct exception *e)
-{
-	struct fail_exception *dd = fail_exception(e);
-	if (dd == NULL) return;
-	if (dd->function) free(dd->function);
-}
+const struct exc_class exc_fail_class = {"fail_exception", sizeof(struct fail_exception), _exc_to_str_fail, NULL,
+	EXCTYPE_CALL, 2, {EXCTYPE_ANY, EXCTYPE_CALL, EXCTYPE_FAIL}};
 
 struct exception *new_fail_exception(const char *function, int retval)
 {
-	struct fail_exception *e = malloc(sizeof(struct fail_exception));
+	struct fail_exception *e = _exc_alloc(EXCTYPE_FAIL, function, offsetof(struct fail_exception, function), NULL, 0);
 	if (e == NULL) throw(&_exc_sys_nomem_g);	// Global const that can be thrown even if no memory can be allocated from the heap
 	e->retval = retval;
-	e->function = strdup(function);
-	_init_exception(&(e->e), EXCTYPE_FAIL, _exc_to_str_fail, _exc_del_fail);
 	return &(e->e);
 }
 
-struct fail_exception *fail_exception(struct exception *e) { return (struct fail_exception *)(e->type == EXCTYPE_FAIL ? e : NULL); }
+struct fail_exception *fail_exception(struct exception *e) { return (struct fail_exception *)(exc_is_a(e, EXCTYPE_FAIL) ? e : NULL); }
 
@@ -3,17 +3,44 @@
 
 #include "exception.h"
 
-#define EXCTYPE_NOMEM 0
-#define EXCTYPE_NAME 1
-#define EXCTYPE_IO 2
-#define EXCTYPE_MEM 3
-#define EXCTYPE_TRUNC 4
-#define EXCTYPE_NULLPTR 5
-#define EXCTYPE_SIG 6
-#define EXCTYPE_FAIL 7
+/* Class hierarchy:
+ * EXCTYPE_ANY
+ *	EXCTYPE_RESOURCE	failure to obtain or use a resource
+ *		EXCTYPE_MEMORY		memory allocation failed
+ *			EXCTYPE_NOMEM
+ *			EXCTYPE_MEM
+ *		EXCTYPE_IO
+ *		EXCTYPE_TRUNC
+ *	EXCTYPE_CALL		a called function or command reported failure
+ *		EXCTYPE_SIG
+ *		EXCTYPE_FAIL
+ *	EXCTYPE_USAGE		invalid arguments passed by the caller
+ *		EXCTYPE_NULLPTR
+ *	EXCTYPE_NAME
+ */
+extern const struct exc_class exc_resource_class, exc_memory_class, exc_call_class, exc_usage_class;
+extern const struct exc_class exc_nomem_class, exc_name_class, exc_io_class, exc_mem_class, exc_trunc_class,
+	exc_nullptr_class, exc_sig_class, exc_fail_class;
+
+#define EXCTYPE_RESOURCE (&exc_resource_class)
+#define EXCTYPE_MEMORY (&exc_memory_class)
+#define EXCTYPE_CALL (&exc_call_class)
+#define EXCTYPE_USAGE (&exc_usage_class)
+
+#define EXCTYPE_NOMEM (&exc_nomem_class)
+#define EXCTYPE_NAME (&exc_name_class)
+#define EXCTYPE_IO (&exc_io_class)
+#define EXCTYPE_MEM (&exc_mem_class)
+#define EXCTYPE_TRUNC (&exc_trunc_class)
+#define EXCTYPE_NULLPTR (&exc_nullptr_class)
+#define EXCTYPE_SIG (&exc_sig_class)
+#define EXCTYPE_FAIL (&exc_fail_class)
 
 extern struct exception _exc_sys_nomem_g;
 
+/* Constructors do not allocate from the heap in the common case: the exception is taken from a per-thread pool,
+ * and string arguments, such as names, filenames and function names, are copied into the same slot. */
+
 /* name_exception */
 struct name_exception {
 	struct exception e;
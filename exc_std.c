@@ -42,6 +42,7 @@ char *strdup_t(const char *s)
 {
 	char *p = strdup(s);
 	if (p == NULL) throw(new_mem_exception("strdup", strlen(s) + 1));
+	return p;
 }
 
 FILE *fopen_t(const char *n, const char *m)
@@ -2,28 +2,144 @@
 #include <stdlib.h>
 #include <string.h>
 #include "exception.h"
+#ifdef ACU_UNWIND
+	#include <unwind.h>
+#endif
 
 __thread struct exception *_exception_ptr = NULL;
 
-__thread jmp_buf *_exc_context = NULL;
+/* Root of the exception class hierarchy */
+const struct exc_class exc_exception_class = {"exception", sizeof(struct exception), NULL, NULL, NULL, 0, {EXCTYPE_ANY}};
 
-void _init_exception(struct exception *e, int type, void (*to_str)(char *, int), void (*del)(struct exception *))
+#ifndef ACU_UNWIND
+	__thread struct _exc_handler *_exc_handlers = NULL;
+#else
+	/* Set by throw while unwinding, and cleared by the TRY catching the exception */
+	__thread int _exc_unwinding = 0;
+	/* Stack pointer of the frame being unwound */
+	__thread char *_exc_unwind_sp = NULL;
+	static __thread struct _Unwind_Exception _exc_unwind_exc;
+	/* Innermost exception set aside by _exc_suspend, or NULL */
+	static __thread struct _exc_suspended *_exc_suspended = NULL;
+#endif
+
+/* Per-thread ring of preallocated exception slots, so that throwing does not need the heap. Only a couple
+ * of exceptions are alive at any time (the one in flight, and the one being replaced by it), so the ring
+ * rarely runs out of free slots; when it does, or when an exception does not fit in a slot, the exception
+ * is allocated from the heap instead. */
+#define _EXC_POOL_SLOTS 8
+#define _EXC_SLOT_SIZE 256
+
+union _exc_slot {
+	struct exception e;
+	long double align;
+	char bytes[_EXC_SLOT_SIZE];
+};
+
+static __thread union _exc_slot _exc_pool[_EXC_POOL_SLOTS];
+static __thread unsigned _exc_pool_used = 0, _exc_pool_next = 0;
+
+/* Set the string fields of exception 'd' to copies of strings 'str' placed right after the object, and return
+ * their total size */
+static size_t _exc_copy_strs(struct exception *d, const char *str[2])
+{
+	size_t n = 0;
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		if (d->str[i] == 0) continue;
+		*(char **)((char *)d + d->str[i]) = str[i] ? strcpy((char *)d + d->cls->size + n, str[i]) : NULL;
+		if (str[i]) n += strlen(str[i]) + 1;
+	}
+	return n;
+}
+
+/* Allocate an exception object of class cls, followed by copies of strings 'str' and 'str2'. Unless 'field' is 0,
+ * set the char pointer at offset 'field' of the object to point to the copy of 'str', or to NULL if 'str' is NULL,
+ * and likewise 'field2' for 'str2'. Return NULL if out of memory. */
+void *_exc_alloc(const struct exc_class *cls, const char *str, size_t field, const char *str2, size_t field2)
 {
-	e->type = type; e->to_str = to_str; e->del = del;
+	size_t n = (str && field ? strlen(str) + 1 : 0) + (str2 && field2 ? strlen(str2) + 1 : 0);
+	const char *strs[2];
+	struct exception *e = NULL;
+	unsigned i;
+
+	if (cls->size + n <= _EXC_SLOT_SIZE) for (i = 0; i < _EXC_POOL_SLOTS; i++)
+	{
+		unsigned k = (_exc_pool_next + i) % _EXC_POOL_SLOTS;
+		if (_exc_pool_used & (1u << k)) continue;
+		_exc_pool_used |= 1u << k;
+		_exc_pool_next = k + 1;
+		e = &(_exc_pool[k].e);
+		e->flags = _EXC_POOLED;
+		break;
+	}
+	if (e == NULL)
+	{
+		if ((e = malloc(cls->size + n)) == NULL) return NULL;
+		e->flags = 0;
+	}
+	e->cls = cls;
+	e->str[0] = field;
+	e->str[1] = field2;
+	strs[0] = str;
+	strs[1] = str2;
+	(void)_exc_copy_strs(e, strs);
+	return e;
 }
 
-void _del_exception(struct exception *e)
+static void _exc_pool_release(struct exception *e)
 {
-	free(e->file);
-	(e->del)(e);
-	free(e);
+	_exc_pool_used &= ~(1u << ((union _exc_slot *)e - _exc_pool));
+}
+
+static void _del_exception(struct exception *e)
+{
+	if (e->flags & _EXC_STATIC) return;
+	if (e->cls->del) (e->cls->del)(e);
+	if (e->flags & _EXC_POOLED) _exc_pool_release(e);
+	else free(e);
+}
+
+void exc_to_str(const struct exception *e, char *buf, int n)
+{
+	if (e->cls->to_str) (e->cls->to_str)(e, buf, n);
+	else snprintf(buf, n, "%s", e->cls->name);
+}
+
+/* Pool slots belong to the throwing thread, so a pooled exception is moved to the heap, together with its strings */
+struct exception *exc_detach(struct exception *e)
+{
+	struct exception *d = e;
+	if (e->flags & _EXC_POOLED)
+	{
+		const char *strs[2];
+		size_t n = 0;
+		int i;
+		for (i = 0; i < 2; i++)
+		{
+			strs[i] = e->str[i] ? *(char **)((char *)e + e->str[i]) : NULL;
+			if (strs[i]) n += strlen(strs[i]) + 1;
+		}
+		if ((d = malloc(e->cls->size + n)) == NULL) return NULL;
+		memcpy(d, e, e->cls->size);
+		d->flags &= ~_EXC_POOLED;
+		(void)_exc_copy_strs(d, strs);
+		_exc_pool_release(e);
+	}
+	if (e == _exception_ptr) _exception_ptr = NULL;
+	return d;
+}
+
+void exc_release(struct exception *e)
+{
+	_del_exception(e);
 }
 
 void _exc_default_handler(void)
 {
 	char buf[256];
-	if (_exception_ptr->to_str) (_exception_ptr->to_str)(buf, sizeof(buf));
-	else snprintf(buf, sizeof(buf), "type %d", _exception_ptr->type);
+	exc_to_str(_exception_ptr, buf, sizeof(buf));
 	fprintf(stderr, "Uncaught exception (%s, line %d): %s\n", _exception_ptr->file, _exception_ptr->line, buf);
 	acu_exit(1);
 }
@@ -35,4 +151,80 @@ void _exc_clear(void)
 	_exception_ptr = NULL;
 }
 
+#ifndef ACU_UNWIND
+/* Jump to the innermost handler catching the exception in flight, or call the default handler if there's none */
+void _exc_throw(void)
+{
+	struct _exc_handler *h;
+	int i;
+
+	for (h = _exc_handlers; h; h = h->prev) for (i = 0; i < h->n; i++)
+	{
+		if (!exc_is_a(_exception_ptr, h->types[i])) continue;
+		_exc_handlers = h->prev;
+		h->state = _EXC_THROWN;
+		longjmp(*(h->context), 1);
+	}
+	_exc_default_handler();
+}
+#else
+static _Unwind_Reason_Code _exc_unwind_stop(int version, _Unwind_Action actions, _Unwind_Exception_Class cls,
+	struct _Unwind_Exception *x, struct _Unwind_Context *context, void *arg)
+{
+	if (actions & _UA_END_OF_STACK)
+	{
+		_exc_unwinding = 0;
+		_exc_default_handler();
+	}
+	_exc_unwind_sp = (char *)_Unwind_GetCFA(context);
+	return _URC_NO_REASON;
+}
+
+/* Set the exception in flight aside in 's', if there's one, before destructors are run for the unwinding */
+void _exc_suspend(struct _exc_suspended *s)
+{
+	s->e = _exc_unwinding ? _exception_ptr : NULL;
+	if (s->e == NULL) return;
+	s->sp = _exc_unwind_sp;
+	s->prev = _exc_suspended;
+	_exc_suspended = s;
+	_exception_ptr = NULL;
+	_exc_unwinding = 0;
+}
+
+/* Resume unwinding the exception set aside in 's', after the destructors have returned */
+void _exc_resume(struct _exc_suspended *s)
+{
+	if (s->e == NULL) return;
+	_exc_clear();
+	_exc_suspended = s->prev;
+	_exception_ptr = s->e;
+	_exc_unwind_sp = s->sp;
+	_exc_unwinding = 1;
+}
 
+/* Called by the TRY with guard at 'guard' landing the exception in flight. Exceptions set aside in frames below
+ * the guard are abandoned with those frames, by a destructor that let its own exception escape. */
+void _exc_landed(char *guard)
+{
+	_exc_unwinding = 0;
+	while (_exc_suspended && (char *)_exc_suspended < guard)
+	{
+		_del_exception(_exc_suspended->e);
+		_exc_suspended = _exc_suspended->prev;
+	}
+}
+
+/* Unwind the stack frame by frame, running the cleanups of the scopes, until a TRY block lands the exception.
+ * If there's none, all scopes have been released by the time the default handler is called. */
+void _exc_throw(void)
+{
+	_exc_unwind_exc.exception_class = 0x4143550045584300ULL;	/* "ACU\0EXC\0" */
+	_exc_unwind_exc.exception_cleanup = NULL;
+	_exc_unwinding = 1;
+	_exc_unwind_sp = NULL;
+	_Unwind_ForcedUnwind(&_exc_unwind_exc, _exc_unwind_stop, NULL);
+	_exc_unwinding = 0;
+	_exc_default_handler();
+}
+#endif
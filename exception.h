@@ -5,44 +5,188 @@
 #include <string.h>
 #include "autocleanup.h"
 
+struct exception;
+
+#define EXC_MAX_DEPTH 8
+
+/* Static descriptor shared by all exceptions of a class. to_str describes exception e into buffer buf of size n,
+ * reading nothing but e, so that an exception can be formatted after it has been caught, or on another thread.
+ * del releases any resources owned by e other than the exception object itself, and may be NULL.
+ * Classes form a single-inheritance hierarchy rooted at EXCTYPE_ANY. Each class lists its ancestors in display,
+ * from the root at index 0 down to the class itself at index depth, so that exc_is_a is a single comparison.
+ * The display is written out in the static initializer of the class, e.g. for a subclass of EXCTYPE_ANY:
+ *   const struct exc_class my_class = {"my_exception", sizeof(struct my_exception), my_to_str, NULL,
+ *	EXCTYPE_ANY, 1, {EXCTYPE_ANY, &my_class}}; */
+struct exc_class {
+	const char *name;
+	size_t size;
+	void (*to_str)(const struct exception *e, char *buf, int n);
+	void (*del)(struct exception *e);
+	const struct exc_class *parent;
+	int depth;
+	const struct exc_class *display[EXC_MAX_DEPTH];
+};
+
 struct exception {
-	int type;
-	void (*to_str)(char *, int);
-	void (*del)(struct exception *);
-	char *file;
+	const struct exc_class *cls;
+	unsigned short flags;
+	unsigned short str[2];	/* offsets of the fields pointing to the strings copied by _exc_alloc, 0 if none */
+	const char *file;
 	int line;
 };
 
-extern __thread jmp_buf *_exc_context;
+extern const struct exc_class exc_exception_class;
+#define EXCTYPE_ANY (&exc_exception_class)
+
+/* Nonzero if exception e is of class t or of a class derived from it. Evaluates its arguments more than once. */
+#define exc_is_a(e, t) ((t)->depth <= (e)->cls->depth && (e)->cls->display[(t)->depth] == (t))
+
+#define _EXC_POOLED 1	/* allocated from the per-thread exception pool */
+#define _EXC_STATIC 2	/* statically allocated, never released */
+
+#define _EXC_REGISTER 0	/* first pass through the CATCH clauses, collecting their classes */
+#define _EXC_RUN 1	/* running the TRY block */
+#define _EXC_THROWN 2	/* landed by throw, no clause has caught the exception yet */
+#define _EXC_CAUGHT 3	/* a clause has caught the exception */
+
+#ifndef ACU_UNWIND
+	#define _EXC_MAX_CLAUSES 8
+
+	/* Handler installed by TRY, listing the classes caught by its CATCH clauses. throw walks the chain of handlers
+	 * and jumps directly to the innermost one catching the exception, skipping the others. */
+	struct _exc_handler {
+		jmp_buf *context;
+		struct _exc_handler *prev;
+		volatile int state;
+		int n;
+		const struct exc_class *types[_EXC_MAX_CLAUSES];
+	};
+
+	extern __thread struct _exc_handler *_exc_handlers;
+#else
+	extern __thread int _exc_unwinding;
+	extern __thread char *_exc_unwind_sp;
+
+	/* Exception in flight set aside by _acu_cleanup while it runs destructors for the unwinding, so that they can
+	 * throw and catch exceptions of their own. Records are kept in the frames of _acu_cleanup, innermost first. */
+	struct _exc_suspended {
+		struct exception *e;
+		char *sp;
+		struct _exc_suspended *prev;
+	};
+	void _exc_suspend(struct _exc_suspended *s);
+	void _exc_resume(struct _exc_suspended *s);
+	void _exc_landed(char *guard);
+#endif
 extern __thread struct exception *_exception_ptr;
 
-void _init_exception(struct exception *, int type, void (*to_str)(char *buf, int n), void (*del)(struct exception *));
+void *_exc_alloc(const struct exc_class *cls, const char *str, size_t field, const char *str2, size_t field2);
+
+/* Write a description of exception e to buf. Safe to call on any live exception, from any thread. */
+void exc_to_str(const struct exception *e, char *buf, int n);
+
+/* Take ownership of exception e, normally the one caught by the enclosing CATCH, so that it is not released at
+ * TRY_END, e.g. to hand it over to a logger thread. Returns the exception to use from now on, which may be a
+ * copy of e, or NULL if the copy could not be allocated, in which case e is left as it was. The returned
+ * exception must not be rethrown, and must eventually be released with exc_release, which may be called on any
+ * thread. */
+struct exception *exc_detach(struct exception *e);
+void exc_release(struct exception *e);
 
 void _exc_default_handler(void);
 void _exc_clear(void);
+void _exc_throw(void);
+
+#ifndef ACU_UNWIND
+	/* TRY opens a BEGIN_BLOCK scope and saves a single context, which is the target of both throw and acu_exit_scope.
+	 * Before running the TRY block, it makes one pass through its CATCH clauses without executing them, to register
+	 * the classes they catch in its handler. A CATCH_TYPE(e, t) clause catches exceptions of class t or derived from
+	 * it, and a CATCH(e) clause catches all exceptions; the first matching clause is executed. throw lands directly
+	 * on the innermost TRY that has a matching clause, so TRY blocks that don't catch an exception are not entered
+	 * and left again on its way; the acu nodes of all the skipped scopes are released at the end of the landing TRY.
+	 * TRY
+	 *	...
+	 * CATCH_TYPE(e, EXCTYPE_IO)
+	 *	...
+	 * CATCH(e)
+	 *	...
+	 * TRY_END
+	 */
+	#ifndef ACU_CLEANUP_ATTR
+		#define _EXC_HANDLER struct _exc_handler _exc_h;
+		#define _EXC_LEAVE if (_exc_h.state == _EXC_CAUGHT) _exc_clear();
+	#else
+		/* The scope brackets don't use setjmp, and acu_exit_scope, return or goto out of the TRY block or a clause
+		 * leave the handler by running its cleanup */
+		static inline void _exc_leave(struct _exc_handler *h)
+		{
+			_exc_handlers = h->prev;
+			if (h->state == _EXC_CAUGHT) _exc_clear();
+		}
+		#define _EXC_HANDLER struct _exc_handler _exc_h __attribute__((cleanup(_exc_leave)));
+		#define _EXC_LEAVE
+	#endif
+
+	#define TRY { __label__ _exc_run; BEGIN_BLOCK \
+		jmp_buf _acu_scope_context; \
+		_EXC_HANDLER \
+		_exc_h.context = &_acu_scope_context; _exc_h.prev = _exc_handlers; \
+		_exc_h.state = _EXC_REGISTER; _exc_h.n = 0; \
+		_exc_run: if (_exc_h.state != _EXC_REGISTER) { \
+		_exc_handlers = &_exc_h; \
+		if (setjmp(_acu_scope_context) == 0) {
 
-#define TRY BEGIN_SCOPE \
-	jmp_buf _new_context, *_prev_context = _exc_context; \
-	_exc_context = &_new_context; \
-	if (setjmp(_new_context) == 0) {
+	#define _EXC_ADD_TYPE(t) (_exc_h.n < _EXC_MAX_CLAUSES ? (void)(_exc_h.types[_exc_h.n++] = (t)) : \
+		(void)(_exc_h.types[_EXC_MAX_CLAUSES - 1] = EXCTYPE_ANY), 0)
 
+	#define CATCH_TYPE(e, t) } } _exc_handlers = _exc_h.prev; \
+		if (_exc_h.state == _EXC_REGISTER ? _EXC_ADD_TYPE(t) : \
+			_exc_h.state == _EXC_THROWN && exc_is_a(_exception_ptr, (t))) { \
+		struct exception *e = _exception_ptr; \
+		_exc_h.state = _EXC_CAUGHT; {
 
-#define CATCH(e) _exc_context = _prev_context; \
-	} else { \
-	struct exception *e = _exception_ptr; \
-	_exc_context = _prev_context;
+	#define CATCH(e) CATCH_TYPE(e, EXCTYPE_ANY)
 
-#define TRY_END _exc_clear(); } END_SCOPE
+	/* A handler with more than _EXC_MAX_CLAUSES clauses catches everything, and rethrows if no clause matches */
+	#define TRY_END } } _exc_handlers = _exc_h.prev; \
+		if (_exc_h.state == _EXC_REGISTER) { _exc_h.state = _EXC_RUN; goto _exc_run; } \
+		if (_exc_h.state == _EXC_THROWN) rethrow; \
+		_EXC_LEAVE \
+		END_BLOCK }
+#else
+	/* TRY puts nothing on the stack at entry. Its block declares a guard variable, whose cleanup function is run
+	 * when the block is left, including by the landing pad of the frame when an exception unwinds through it.
+	 * _exc_unwind_sp is the stack pointer of the frame being unwound, so the guard of the TRY in that frame is at
+	 * or above it, whereas any TRY in a destructor run by the landing pad is below it. The guard then jumps to the
+	 * clauses, abandoning the unwinding. A TRY with no clause catching the exception lands too, and rethrows.
+	 * Unlike with setjmp, the acu nodes of the scopes unwound are already released when a CATCH clause runs. */
+	#define TRY { __label__ _exc_land, _acu_scope_end; _ACU_FRAME(_acu_frame_scope) \
+		volatile int _exc_state = _EXC_RUN; \
+		void _exc_catcher(char *g) { \
+			if (_exc_unwinding && g >= _exc_unwind_sp) { _exc_landed(g); _exc_state = _EXC_THROWN; goto _exc_land; } \
+		} \
+		_exc_land: if (_exc_state == _EXC_RUN) { \
+		char _exc_guard __attribute__((cleanup(_exc_catcher))); {
+
+	#define CATCH_TYPE(e, t) } } \
+		if (_exc_state == _EXC_THROWN && exc_is_a(_exception_ptr, (t))) { \
+		struct exception *e = _exception_ptr; \
+		_exc_state = _EXC_CAUGHT; {
+
+	#define CATCH(e) CATCH_TYPE(e, EXCTYPE_ANY)
+
+	#define TRY_END } } _acu_scope_end: __attribute__((unused)); \
+		if (_exc_state == _EXC_THROWN) rethrow; \
+		if (_exc_state == _EXC_CAUGHT) _exc_clear(); }
+#endif
 
 #define throw(e) { struct exception *_e = (e); \
 	if (_e && _e != _exception_ptr) { \
 		_exc_clear(); _exception_ptr = _e; \
-		_e->line = __LINE__; _e->file = strdup(__FILE__); \
+		_e->line = __LINE__; _e->file = __FILE__; \
 	} \
-	if (_exc_context) longjmp(*_exc_context, 1); \
-	_exc_default_handler(); }
+	_exc_throw(); }
 
 #define rethrow throw(NULL)
 
 #endif
-
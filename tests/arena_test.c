@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+#include "../acu_std.h"
+
+/* Test scoped arenas: acu_malloc, acu_calloc and acu_strdup called at the depth of the scope of the current arena
+ * must allocate from it, aligned and without overlapping, and without a unique node, so that acu_latest() throws
+ * after them, while deeper scopes, and scopes left with no arena at their depth, allocate from the heap with a
+ * node of their own. A nested arena must serve its scope only, and the outer one must serve again once the nested
+ * one is released, also when arenas are released out of order. Leaks of chunks at the end of the scope or on an
+ * exception are best checked by building with -fsanitize=address.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -fsanitize=address tests/arena_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o arena_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack. Exits with status 0 and prints "ok" on success. */
+
+#define ALLOCS 1000
+
+static int failures;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Return whether the last allocation came from an arena, which leaves acu_latest() nothing to return */
+static int from_arena(void)
+{
+	int thrown = 0;
+	TRY
+		(void)acu_latest();
+	CATCH(ex)
+		(void)ex;
+		thrown = 1;
+	TRY_END
+	return thrown;
+}
+
+/* Fill ALLOCS blocks of growing sizes, including ones larger than a chunk, and check them afterwards */
+static void fill_and_check(void)
+BEGIN
+	static unsigned char *p[ALLOCS];
+	int i, aligned = 1, intact = 1, zeroed = 1;
+	for (i = 0; i < ALLOCS; i++)
+	{
+		size_t n = i % 100 == 99 ? 5000 : (size_t)i % 64 + 1, j;
+		p[i] = i % 2 ? acu_calloc_t(n, 1) : acu_malloc_t(n);
+		if ((uintptr_t)p[i] % 16) aligned = 0;
+		for (j = 0; j < n; j++) if (i % 2 && p[i][j]) zeroed = 0;
+		memset(p[i], i & 0xff, n);
+	}
+	for (i = 0; i < ALLOCS; i++)
+	{
+		size_t n = i % 100 == 99 ? 5000 : (size_t)i % 64 + 1, j;
+		for (j = 0; j < n; j++) if (p[i][j] != (i & 0xff)) intact = 0;
+	}
+	check(aligned, "arena blocks aligned");
+	check(zeroed, "arena blocks from acu_calloc zeroed");
+	check(intact, "arena blocks not overlapping");
+END
+
+/* Open an arena with small chunks, allocate from it, and throw */
+static void arena_and_throw(void)
+BEGIN
+	(void)acu_arena_t(256);
+	(void)acu_strdup_t("lost");
+	(void)acu_malloc_t(1000);
+	throw(new_name_exception("arena_and_throw"));
+END
+
+int main(void)
+BEGIN
+	BEGIN_SCOPE
+		(void)acu_arena_t(1024);
+		(void)acu_malloc_t(10);
+		check(from_arena(), "allocation at the depth of the arena");
+		BEGIN_SCOPE
+			(void)acu_malloc_t(10);
+			check(!from_arena(), "allocation in a deeper scope");
+		END_SCOPE
+		BEGIN_SCOPE
+			(void)acu_arena_t(0);
+			(void)acu_strdup_t("inner");
+			check(from_arena(), "allocation at the depth of a nested arena");
+		END_SCOPE
+		(void)acu_strdup_t("outer");
+		check(from_arena(), "allocation after a nested arena is released");
+	END_SCOPE
+
+	BEGIN_SCOPE
+		(void)acu_malloc_t(10);
+		check(!from_arena(), "allocation after the arena is released");
+	END_SCOPE
+
+	BEGIN_SCOPE
+		(void)acu_arena_t(512);
+		fill_and_check();
+		BEGIN_SCOPE
+			(void)acu_arena_t(512);
+			fill_and_check();
+		END_SCOPE
+	END_SCOPE
+
+	BEGIN_SCOPE
+		acu_unique *a = acu_arena_t(0), *b = acu_arena_t(0);
+		acu_destruct(a);
+		(void)acu_calloc_t(2, 8);
+		check(from_arena(), "allocation after releasing an earlier arena");
+		acu_destruct(b);
+		(void)acu_calloc_t(2, 8);
+		check(!from_arena(), "allocation after releasing both arenas");
+	END_SCOPE
+
+	TRY
+		arena_and_throw();
+	CATCH(ex)
+		(void)ex;
+	TRY_END
+	(void)acu_malloc_t(10);
+	check(!from_arena(), "allocation after an exception released the arena");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+
+/* Test acu_new_unique_arg: the destructor must be passed the argument stored with its object wherever the object
+ * goes, whether destructed at the end of its scope, explicitly, by an exception, after being yielded, transferred
+ * or swapped to another node, or shared, and with ACU_THREAD_SAFE also when deferred to the reaper. Each object is
+ * a one-letter string with the argument ARG(letter), and its destructor appends the letter to a log if it gets the
+ * right argument, '?' otherwise; the log is compared with the expected order.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -fsanitize=address tests/arg_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o arg_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack, or -DACU_THREAD_SAFE -pthread for deferred destruction.
+ * Exits with status 0 and prints "ok" on success. */
+
+#define ARG(c) (0x5a00u + (unsigned char)(c))
+
+static char log_buf[32];
+static int log_len, failures;
+
+static void note(char c) { if (log_len < 31) log_buf[log_len++] = c; }
+
+static void del_arg(void *p, uintptr_t arg)
+{
+	const char *s = p;
+	note(arg == ARG(*s) ? *s : '?');
+}
+
+static void del_log(void *p) { note(*(const char *)p); }
+
+static acu_unique *obj_arg(const char *name) { return acu_new_unique_arg((void *)name, ARG(*name), del_arg); }
+
+static acu_unique *obj(const char *name) { return acu_new_unique((void *)name, del_log); }
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void check_log(const char *expected, const char *what)
+{
+	log_buf[log_len] = '\0';
+	if (strcmp(log_buf, expected))
+	{
+		printf("FAIL: %s: destructed %s, expected %s\n", what, log_buf, expected);
+		failures++;
+	}
+	log_len = 0;
+}
+
+/* Create "a" with an argument and "b" without, yield "a", and throw if 'fail' */
+static acu_unique *make(int fail)
+BEGIN
+	acu_unique *a = obj_arg("a");
+	(void)obj("b");
+	acu_yield(a);
+	if (fail) throw(new_name_exception("make"));
+	acu_return a;
+END
+
+/* Move "c" and "d" to the nodes of the caller, by acu_transfer and acu_swap */
+static void hand_out(acu_unique *to_c, acu_unique *to_d)
+BEGIN
+	acu_unique *c = obj_arg("c"), *d = obj_arg("d");
+	acu_transfer(c, to_c);
+	acu_swap(d, to_d);
+	check(acu_get_ptr(to_c) != NULL && *(const char *)acu_get_ptr(to_c) == 'c', "object reached after transfer");
+	check(acu_get_ptr(to_d) != NULL && *(const char *)acu_get_ptr(to_d) == 'd', "object reached after swap");
+END
+
+int main(void)
+BEGIN
+	BEGIN_SCOPE
+		(void)obj_arg("a");
+		(void)obj("b");
+		acu_destruct(obj_arg("c"));
+		check_log("c", "explicit destruction");
+		(void)obj_arg("d");
+	END_SCOPE
+	check_log("dba", "end of the scope");
+
+	BEGIN_SCOPE
+		(void)make(0);
+		check_log("b", "make returns");
+	END_SCOPE
+	check_log("a", "yielded object");
+
+	TRY
+		(void)make(1);
+	CATCH(ex)
+		(void)ex;
+	TRY_END
+	check_log("ba", "exception");
+
+	BEGIN_SCOPE
+		acu_unique *c = acu_reserve(), *d = obj("x");
+		hand_out(c, d);
+		check_log("x", "hand_out returns");
+	END_SCOPE
+	check_log("dc", "transferred and swapped objects");
+
+	BEGIN_SCOPE
+		acu_unique *r;
+		acu_shared *s = acu_share(obj_arg("s"));
+		r = acu_new_reference(s);
+		check(*(const char *)acu_get_ptr(r) == 's', "shared object reached through a reference");
+		acu_destruct(r);
+		check_log("", "shared object kept by the first reference");
+	END_SCOPE
+	check_log("s", "shared object");
+
+	#ifdef ACU_THREAD_SAFE
+		BEGIN_SCOPE
+			acu_defer_destruct(obj_arg("e"));
+		END_SCOPE
+		acu_drain_deferred();
+		check_log("e", "deferred object");
+	#endif
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+
+/* Test the dispatch of typed CATCH clauses: an exception must be caught by the first matching clause of the
+ * innermost TRY that has one, by class or by an ancestor class, while TRYs with no matching clause are passed by
+ * without running any of their clauses, and the objects of all scopes left are destructed. A destructor run for
+ * an exception may throw and catch one of its own without disturbing the first. Clauses and destructors append a
+ * letter to a log that is compared with the expected sequence.
+ *
+ * Build from the repository root, e.g.
+ *   gcc tests/catch_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o catch_test
+ * and add -DACU_CLEANUP_ATTR, or -DACU_UNWIND -fexceptions, for the other scope implementations. Exits with
+ * status 0 and prints "ok" on success. */
+
+/* Log of a landing: with ACU_UNWIND, the objects of the scopes left are destructed before the clause runs,
+ * otherwise at the end of the TRY */
+#ifdef ACU_UNWIND
+	#define LANDED(clause, destructed) destructed clause
+#else
+	#define LANDED(clause, destructed) clause destructed
+#endif
+
+static char log_buf[32];
+static int log_len, failures;
+
+static void note(char c) { if (log_len < 31) log_buf[log_len++] = c; }
+
+static void del_log(void *p) { note(*(const char *)p); }
+
+static void check_log(const char *expected, const char *what)
+{
+	log_buf[log_len] = '\0';
+	if (strcmp(log_buf, expected))
+	{
+		printf("FAIL: %s: logged %s, expected %s\n", what, log_buf, expected);
+		failures++;
+	}
+	log_len = 0;
+}
+
+/* Destructor catching an exception of its own before logging its object */
+static void del_catching(void *p)
+{
+	TRY
+		throw(new_io_exception(0, "f", "del_catching"));
+	CATCH_TYPE(ex, EXCTYPE_IO)
+		(void)ex;
+		note('c');
+	TRY_END
+	note(*(const char *)p);
+}
+
+/* Create object "z" with a destructor using TRY, and throw 'e' */
+static void throw_through_try(struct exception *e)
+BEGIN
+	(void)acu_new_unique("z", del_catching);
+	throw(e);
+END
+
+/* Create object "x", and throw 'e' from within a TRY catching only I/O exceptions */
+static void throw_past(struct exception *e)
+BEGIN
+	(void)acu_new_unique("x", del_log);
+	TRY
+		(void)acu_new_unique("y", del_log);
+		throw(e);
+	CATCH_TYPE(ex, EXCTYPE_IO)
+		(void)ex;
+		note('I');
+	TRY_END
+	note('!');
+END
+
+int main(void)
+BEGIN
+	TRY
+		throw_past(new_name_exception("main"));
+	CATCH_TYPE(ex, EXCTYPE_IO)
+		(void)ex;
+		note('I');
+	CATCH_TYPE(ex, EXCTYPE_NAME)
+		(void)ex;
+		note('N');
+	CATCH(ex)
+		(void)ex;
+		note('A');
+	TRY_END
+	check_log(LANDED("N", "yx"), "name exception past an I/O handler");
+
+	TRY
+		throw_past(new_mem_exception("main", 1));
+	CATCH_TYPE(ex, EXCTYPE_RESOURCE)
+		note(exc_is_a(ex, EXCTYPE_MEM) ? 'R' : '?');
+	CATCH(ex)
+		(void)ex;
+		note('A');
+	TRY_END
+	check_log(LANDED("R", "yx"), "memory exception caught as a resource exception");
+
+	TRY
+		TRY
+			throw_past(new_name_exception("main"));
+		CATCH_TYPE(ex, EXCTYPE_USAGE)
+			(void)ex;
+			note('U');
+		TRY_END
+		note('!');
+	CATCH(ex)
+		(void)ex;
+		note('A');
+	TRY_END
+	check_log(LANDED("A", "yx"), "name exception past two handlers");
+
+	TRY
+		throw_past(new_io_exception(0, "f", "main"));
+	CATCH(ex)
+		(void)ex;
+		note('A');
+	TRY_END
+	check_log("Iy!x", "I/O exception caught by the inner handler");
+
+	TRY
+		throw_through_try(new_name_exception("main"));
+	CATCH_TYPE(ex, EXCTYPE_NAME)
+		(void)ex;
+		note('N');
+	CATCH(ex)
+		(void)ex;
+		note('A');
+	TRY_END
+	check_log(LANDED("N", "cz"), "exception caught in a destructor");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+#include "../acu_std.h"
+
+/* Test acu_defer_destruct: deferred objects must be destructed on the reaper thread, in the order inline cleanup
+ * would have destructed them, by the time acu_drain_deferred returns, while locks, references to shared pointers
+ * and objects bound to the creating thread, like arenas, must be rejected and stay owned by their scope, which
+ * releases them inline.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -pthread -DACU_THREAD_SAFE -fsanitize=address tests/defer_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o defer_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack. Exits with status 0 and prints "ok" on success. */
+
+#ifndef ACU_THREAD_SAFE
+	#error "acu_defer_destruct requires ACU_THREAD_SAFE"
+#endif
+
+#define DEFERRED 100
+
+static int failures, order[DEFERRED], ndeferred, off_thread;
+static pthread_t main_thread;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Return whether deferring 'u' throws */
+static int defer_throws(acu_unique *u)
+{
+	int thrown = 0;
+	TRY
+		acu_defer_destruct(u);
+	CATCH(ex)
+		(void)ex;
+		thrown = 1;
+	TRY_END
+	return thrown;
+}
+
+static void del_deferred(void *p)
+{
+	if (!pthread_equal(pthread_self(), main_thread)) off_thread++;
+	order[ndeferred++] = *(int *)p;
+	free(p);
+}
+
+/* Create DEFERRED objects numbered in order of creation and defer them all */
+static void defer_scope(void)
+BEGIN
+	int i;
+	for (i = 0; i < DEFERRED; i++)
+	{
+		int *p = malloc(sizeof(int));
+		*p = i;
+		acu_defer_destruct(acu_new_unique(p, del_deferred));
+	}
+END
+
+/* Try to defer a lock and references to a shared pointer, which must stay inline */
+static void defer_rejected(void)
+BEGIN
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	acu_shared *s = acu_share(acu_new_unique(malloc(1), free));
+	check(defer_throws(acu_pthread_mutex_lock(&lock)), "deferring a lock throws");
+	check(defer_throws(acu_new_reference(s)), "deferring a strong reference throws");
+	check(defer_throws(acu_new_weak_reference(s)), "deferring a weak reference throws");
+END
+
+/* Open an arena, try to defer and share it, and keep allocating from it */
+static void arena_scope(void)
+BEGIN
+	acu_unique *a = acu_arena_t(0);
+	char *p = acu_strdup_t("before"), *q;
+	int thrown = 0;
+	check(defer_throws(a), "deferring an arena throws");
+	TRY
+		(void)acu_share(a);
+	CATCH(ex)
+		(void)ex;
+		thrown = 1;
+	TRY_END
+	check(thrown, "sharing an arena throws");
+	q = acu_strdup_t("after");
+	check(!strcmp(p, "before") && !strcmp(q, "after"), "arena still serves its scope");
+END
+
+int main(void)
+BEGIN
+	int i, in_order = 1;
+	main_thread = pthread_self();
+	defer_scope();
+	acu_drain_deferred();
+	for (i = 0; i < ndeferred; i++) if (order[i] != DEFERRED - 1 - i) in_order = 0;
+	check(ndeferred == DEFERRED, "deferred objects destructed by acu_drain_deferred");
+	check(off_thread == ndeferred, "deferred objects destructed on the reaper");
+	check(in_order, "deferred objects destructed in reverse order of creation");
+
+	defer_rejected();
+	for (i = 0; i < 3; i++) arena_scope();
+	acu_drain_deferred();
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+
+/* Test that a unique node embedded in its object can't be made to take another object: swapping it with another
+ * node, transferring to it and sharing it must throw and leave both objects owned as before, while transferring
+ * its object to another node must unlink it. Every object must be destructed exactly once, which is best checked
+ * by building with -fsanitize=address.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -fsanitize=address tests/embedded_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o embedded_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack, where the embedded header is unused. Exits with status 0
+ * and prints "ok" on success. */
+
+struct obj {
+	acu_header h;
+	int id;
+};
+
+static int destructed[4], failures;
+
+static void del_obj(void *p)
+{
+	struct obj *o = p;
+	destructed[o->id]++;
+	free(o);
+}
+
+static void del_id(void *p)
+{
+	destructed[*(int *)p]++;
+	free(p);
+}
+
+static struct obj *new_obj(int id)
+{
+	struct obj *o = malloc(sizeof(struct obj));
+	o->id = id;
+	return o;
+}
+
+static int *new_id(int id)
+{
+	int *p = malloc(sizeof(int));
+	*p = id;
+	return p;
+}
+
+static void check(int cond, const char *what)
+{
+	if (!cond)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Run 'op' on embedded node 'e' and plain node 'u', and check whether it threw */
+static int throws(void (*op)(acu_unique *e, acu_unique *u), acu_unique *e, acu_unique *u)
+{
+	int thrown = 0;
+	TRY
+		op(e, u);
+	CATCH(ex)
+		(void)ex;
+		thrown = 1;
+	TRY_END
+	return thrown;
+}
+
+static void swap(acu_unique *e, acu_unique *u) { acu_swap(e, u); }
+#ifndef ACU_ARRAY_STACK
+	static void swap_back(acu_unique *e, acu_unique *u) { acu_swap(u, e); }
+	static void transfer_to(acu_unique *e, acu_unique *u) { acu_transfer(u, e); }
+	static void share(acu_unique *e, acu_unique *u) { (void)acu_share(e); }
+#endif
+
+int main(void)
+BEGIN
+	BEGIN_SCOPE
+		struct obj *o = new_obj(0);
+		acu_unique *e = acu_register_embedded(&o->h, del_obj);
+		acu_unique *u = acu_new_unique(new_id(1), del_id);
+		#ifndef ACU_ARRAY_STACK
+			check(throws(swap, e, u), "acu_swap(embedded, node) throws");
+			check(throws(swap_back, e, u), "acu_swap(node, embedded) throws");
+			check(throws(transfer_to, e, u), "acu_transfer(node, embedded) throws");
+			check(throws(share, e, u), "acu_share(embedded) throws");
+			check(acu_get_ptr(e) == &o->h && *(int *)acu_get_ptr(u) == 1, "objects stay with their nodes");
+		#else
+			check(!throws(swap, e, u), "acu_swap of array entries does not throw");
+			check(*(int *)acu_get_ptr(e) == 1, "swapped array entries");
+		#endif
+	END_SCOPE
+	check(destructed[0] == 1 && destructed[1] == 1, "each object destructed once after swaps");
+
+	BEGIN_SCOPE
+		struct obj *o = new_obj(2);
+		acu_unique *e = acu_register_embedded(&o->h, del_obj);
+		acu_unique *u = acu_new_unique(NULL, NULL);
+		acu_transfer(e, u);
+		check(destructed[2] == 0, "transfer from embedded node does not destruct");
+		check(acu_get_ptr(u) == &o->h, "transfer from embedded node moves the object");
+	END_SCOPE
+	check(destructed[2] == 1, "object transferred from embedded node destructed once");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+
+/* Test the loop that replaces an object by a new one, creating the new one before destructing the old: the
+ * cleanup stack must stay bounded however often it runs, and objects left behind by an exception in the middle
+ * of a replacement must still be destructed in reverse order of creation. Each object is a one-letter string,
+ * and its destructor appends it to a log that is compared with the expected order.
+ *
+ * Build from the repository root, e.g.
+ *   gcc tests/replace_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o replace_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack. Exits with status 0 and prints "ok" on success. */
+
+#define ROUNDS 100000
+#define BOUND 16
+
+static char log_buf[32];
+static int log_len, failures;
+
+static void del_log(void *p) { if (log_len < 31) log_buf[log_len++] = *(const char *)p; }
+
+static void del_none(void *p) { (void)p; }
+
+static acu_unique *obj(const char *name) { return acu_new_unique((void *)name, del_log); }
+
+static void check_log(const char *expected, const char *what)
+{
+	log_buf[log_len] = '\0';
+	if (strcmp(log_buf, expected))
+	{
+		printf("FAIL: %s: destructed %s, expected %s\n", what, log_buf, expected);
+		failures++;
+	}
+	log_len = 0;
+}
+
+/* Number of entries or nodes the main stack of the thread occupies */
+static long stack_size(void)
+{
+	#ifdef ACU_ARRAY_STACK
+		return _acu_top;
+	#else
+		struct acu_slab_stats st;
+		acu_get_slab_stats(&st);
+		return (long)st.live;
+	#endif
+}
+
+/* Replace an object ROUNDS times, and return how much the stack grew at most */
+static long replace_loop(void)
+BEGIN
+	acu_unique *old = acu_new_unique(NULL, del_none), *n;
+	long base = stack_size(), grown = 0, i;
+	for (i = 0; i < ROUNDS; i++)
+	{
+		n = acu_new_unique(NULL, del_none);
+		acu_destruct(old);
+		old = n;
+		if (stack_size() - base > grown) grown = stack_size() - base;
+	}
+	acu_return grown;
+END
+
+/* Replace "a" by "b" and "b" by "c", then create "d" and throw while "c" still waits for its predecessor to go */
+static void replace_and_throw(void)
+BEGIN
+	acu_unique *old = obj("a"), *n;
+	n = obj("b");
+	acu_destruct(old);
+	old = n;
+	n = obj("c");
+	(void)obj("d");
+	throw(new_name_exception("replace_and_throw"));
+END
+
+int main(void)
+BEGIN
+	long grown = replace_loop();
+	if (grown > BOUND)
+	{
+		printf("FAIL: replacing %d times grew the stack by %ld\n", ROUNDS, grown);
+		failures++;
+	}
+
+	TRY
+		replace_and_throw();
+	CATCH(ex)
+		(void)ex;
+	TRY_END
+	check_log("adcb", "exception during replacement");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
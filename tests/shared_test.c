@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#ifdef ACU_THREAD_SAFE
+	#include <pthread.h>
+#endif
+
+/* Test the transitions of the strong and weak counts of shared pointers: the object must be destructed exactly
+ * once, when the last strong reference goes, whatever weak references remain, and the shared node must be freed
+ * when the last reference of either kind goes, which is best checked by building with -fsanitize=address. Locking
+ * a weak reference must give a strong one while the object lives, and NULL once it has been destructed, also when
+ * another thread drops the last strong reference meanwhile. With ACU_THREAD_SAFE, the thread dropping the last
+ * reference must see what the other threads wrote to the object before dropping theirs, and handing references
+ * off by acu_transfer or acu_swap must stop the sharing thread from counting without atomics.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -fsanitize=address tests/shared_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o shared_test
+ * and add -DACU_THREAD_SAFE -pthread for the atomic counts. Exits with status 0 and prints "ok" on success. */
+
+static int destructed, failures;
+
+static void del_count(void *p)
+{
+	destructed++;
+	free(p);
+}
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Share an object, take a second strong reference and a weak one, and drop them in the order given by 'order',
+ * a permutation of "usw" naming the original, the second strong and the weak reference */
+static void drop_in_order(const char *order)
+BEGIN
+	acu_unique *u = acu_new_unique(malloc(1), del_count), *r[3];
+	acu_shared *s = acu_share(u);
+	int i, strong = 2;
+	r[0] = u;
+	r[1] = acu_new_reference(s);
+	r[2] = acu_new_weak_reference(s);
+	destructed = 0;
+	for (i = 0; i < 3; i++)
+	{
+		int k = order[i] == 'u' ? 0 : order[i] == 's' ? 1 : 2;
+		acu_destruct(r[k]);
+		if (k < 2) strong--;
+		check(destructed == (strong == 0), order);
+	}
+END
+
+/* Lock a weak reference before and after the last strong reference goes */
+static void lock_weak(void)
+BEGIN
+	acu_unique *u = acu_new_unique(malloc(1), del_count), *w, *l;
+	acu_shared *s = acu_share(u);
+	w = acu_new_weak_reference(s);
+	destructed = 0;
+	l = acu_lock_reference(w);
+	check(l != NULL, "locking a live object");
+	acu_destruct(u);
+	check(destructed == 0, "object kept alive by the locked reference");
+	check(l && acu_get_ptr(l) != NULL, "object reached through the locked reference");
+	if (l) acu_destruct(l);
+	check(destructed == 1, "object destructed with the locked reference");
+	check(acu_lock_reference(w) == NULL, "locking a destructed object");
+	check(destructed == 1, "failed lock leaves the object alone");
+END
+
+#ifdef ACU_THREAD_SAFE
+#define RACES 200
+
+struct obj {
+	int alive;
+};
+
+static pthread_barrier_t ready, go;
+static acu_unique *slot;
+static int dead_locked;
+
+static void del_obj(void *p)
+{
+	((struct obj *)p)->alive = 0;
+	free(p);
+}
+
+/* Reserve 'slot' for a weak reference, and lock it until that fails, counting locked objects that were dead */
+static void *locker(void *arg)
+BEGIN
+	acu_unique *l;
+	(void)arg;
+	slot = acu_reserve();
+	pthread_barrier_wait(&ready);
+	pthread_barrier_wait(&go);
+	while ((l = acu_lock_reference(slot)))
+	{
+		if (!((struct obj *)acu_get_ptr(l))->alive) dead_locked++;
+		acu_destruct(l);
+	}
+	acu_return NULL;
+END
+
+/* Drop the last strong reference while another thread keeps locking a weak one */
+static void lock_race(void)
+BEGIN
+	int i;
+	pthread_barrier_init(&ready, NULL, 2);
+	pthread_barrier_init(&go, NULL, 2);
+	for (i = 0; i < RACES; i++)
+	BEGIN_SCOPE
+		pthread_t tid;
+		struct obj *o = malloc(sizeof(struct obj));
+		acu_unique *u;
+		acu_shared *s;
+		o->alive = 1;
+		u = acu_new_unique(o, del_obj);
+		s = acu_share(u);
+		pthread_create(&tid, NULL, locker, NULL);
+		pthread_barrier_wait(&ready);
+		acu_transfer(acu_new_weak_reference(s), slot);
+		pthread_barrier_wait(&go);
+		acu_destruct(u);
+		pthread_join(tid, NULL);
+	END_SCOPE
+	pthread_barrier_destroy(&ready);
+	pthread_barrier_destroy(&go);
+	check(dead_locked == 0, "locking while the last strong reference is dropped");
+END
+
+#define WRITERS 4
+#define WRITES 10000
+
+struct tally {
+	long n[WRITERS];
+};
+
+static acu_unique *slots[WRITERS];
+static acu_shared *hot;
+static long tallied;
+
+static void del_tally(void *p)
+{
+	struct tally *t = p;
+	int i;
+	for (i = 0; i < WRITERS; i++) tallied += t->n[i];
+	free(t);
+}
+
+/* Reserve a slot for a reference to the shared tally, then count in the tally with references of its own */
+static void *writer(void *arg)
+BEGIN
+	long k = (long)arg, i;
+	slots[k] = acu_reserve();
+	pthread_barrier_wait(&ready);
+	pthread_barrier_wait(&go);
+	for (i = 0; i < WRITES; i++)
+	{
+		acu_unique *r = acu_new_reference(hot);
+		((struct tally *)acu_get_ptr(r))->n[k]++;
+		acu_destruct(r);
+	}
+	acu_return NULL;
+END
+
+/* Hand references to a tally to WRITERS threads and drop the own one at once, so that a writer drops the last */
+static void last_drop(void)
+BEGIN
+	pthread_t tid[WRITERS];
+	long k;
+	acu_unique *u = acu_new_unique(calloc(1, sizeof(struct tally)), del_tally);
+	acu_shared *s = hot = acu_share(u);
+	pthread_barrier_init(&ready, NULL, WRITERS + 1);
+	pthread_barrier_init(&go, NULL, WRITERS + 1);
+	for (k = 0; k < WRITERS; k++) pthread_create(&tid[k], NULL, writer, (void *)k);
+	pthread_barrier_wait(&ready);
+	for (k = 0; k < WRITERS; k++) acu_transfer(acu_new_reference(s), slots[k]);
+	acu_destruct(u);
+	pthread_barrier_wait(&go);
+	for (k = 0; k < WRITERS; k++) pthread_join(tid[k], NULL);
+	pthread_barrier_destroy(&ready);
+	pthread_barrier_destroy(&go);
+	check(tallied == WRITERS * WRITES, "writes seen by the thread dropping the last reference");
+END
+
+/* Reserve a slot for a reference, then take and drop references of its own */
+static void *churner(void *arg)
+BEGIN
+	long k = (long)arg, i;
+	slots[k] = acu_reserve();
+	pthread_barrier_wait(&ready);
+	pthread_barrier_wait(&go);
+	for (i = 0; i < WRITES; i++) acu_destruct(acu_new_reference(hot));
+	acu_return NULL;
+END
+
+/* Hand references off to two threads, one by acu_transfer and one by acu_swap, and take and drop references
+ * concurrently with them; the object must live until the owner drops the last reference */
+static void handoff(void)
+BEGIN
+	pthread_t tid[2];
+	long k, i;
+	acu_unique *u = acu_new_unique(malloc(1), del_count), *r;
+	hot = acu_share(u);
+	for (i = 0; i < WRITES; i++) acu_destruct(acu_new_reference(hot));
+	pthread_barrier_init(&ready, NULL, 3);
+	pthread_barrier_init(&go, NULL, 3);
+	for (k = 0; k < 2; k++) pthread_create(&tid[k], NULL, churner, (void *)k);
+	pthread_barrier_wait(&ready);
+	acu_transfer(acu_new_reference(hot), slots[0]);
+	r = acu_new_reference(hot);
+	acu_swap(r, slots[1]);
+	acu_destruct(r);
+	destructed = 0;
+	pthread_barrier_wait(&go);
+	for (i = 0; i < WRITES; i++) acu_destruct(acu_new_reference(hot));
+	for (k = 0; k < 2; k++) pthread_join(tid[k], NULL);
+	pthread_barrier_destroy(&ready);
+	pthread_barrier_destroy(&go);
+	check(destructed == 0, "object alive while the owner holds a reference after handoff");
+	acu_destruct(u);
+	check(destructed == 1, "object destructed by the owner's last drop after handoff");
+END
+#endif
+
+int main(void)
+BEGIN
+	static const char *orders[] = { "usw", "suw", "uws", "swu", "wus", "wsu" };
+	int i;
+	for (i = 0; i < 6; i++) drop_in_order(orders[i]);
+	lock_weak();
+	#ifdef ACU_THREAD_SAFE
+		lock_race();
+		last_drop();
+		handoff();
+	#endif
+
+	BEGIN_SCOPE
+		acu_shared *s = acu_share(acu_new_unique(malloc(1), del_count));
+		(void)acu_new_weak_reference(s);
+		(void)acu_new_reference(s);
+		destructed = 0;
+	END_SCOPE
+	check(destructed == 1, "references left to the end of the scope");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
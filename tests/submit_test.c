@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#ifdef ACU_THREAD_SAFE
+	#include <pthread.h>
+#endif
+
+/* Test acu_submit_to: objects submitted to a shared object must be left alone by the scope that created them and
+ * by weak references, and destructed exactly once, in reverse order of submission and before the shared object
+ * itself, when the last strong reference goes. With ACU_THREAD_SAFE, several threads submit to the same shared
+ * object at once, which is best checked by building with -fsanitize=thread.
+ *
+ * Build from the repository root, e.g.
+ *   gcc -fsanitize=address tests/submit_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o submit_test
+ * and add -DACU_THREAD_SAFE -pthread for concurrent submitters. Exits with status 0 and prints "ok" on success. */
+
+static char log_buf[32];
+static int log_len, failures;
+
+static void del_log(void *p) { if (log_len < 31) log_buf[log_len++] = *(const char *)p; }
+
+static acu_unique *obj(const char *name) { return acu_new_unique((void *)name, del_log); }
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void check_log(const char *expected, const char *what)
+{
+	log_buf[log_len] = '\0';
+	if (strcmp(log_buf, expected))
+	{
+		printf("FAIL: %s: destructed %s, expected %s\n", what, log_buf, expected);
+		failures++;
+	}
+	log_len = 0;
+}
+
+/* Submit "a", "b" and "c" to shared object 's' from a scope of their own */
+static void submit_three(acu_shared *s)
+BEGIN
+	acu_submit_to(obj("a"), s);
+	acu_submit_to(obj("b"), s);
+	acu_submit_to(obj("c"), s);
+END
+
+/* Submit to a shared object "s", and drop a second strong reference and a weak one before the original */
+static void submit_and_drop(void)
+BEGIN
+	acu_unique *u = obj("s"), *r, *w;
+	acu_shared *s = acu_share(u);
+	r = acu_new_reference(s);
+	w = acu_new_weak_reference(s);
+	submit_three(s);
+	check_log("", "submitted objects left alone by their scope");
+	acu_destruct(r);
+	check_log("", "submitted objects kept by the remaining reference");
+	acu_destruct(u);
+	check_log("cbas", "submitted objects destructed with the last strong reference");
+	acu_destruct(w);
+	check_log("", "submitted objects destructed once");
+END
+
+#ifdef ACU_THREAD_SAFE
+#define SUBMITTERS 4
+#define SUBMITS 1000
+
+static pthread_barrier_t ready, go;
+static acu_unique *slots[SUBMITTERS];
+static acu_shared *hot;
+static int destructed;
+
+static void del_count(void *p)
+{
+	destructed++;
+	free(p);
+}
+
+/* Reserve a slot for a reference to the shared object, then submit SUBMITS objects to it */
+static void *submitter(void *arg)
+BEGIN
+	long k = (long)arg, i;
+	slots[k] = acu_reserve();
+	pthread_barrier_wait(&ready);
+	pthread_barrier_wait(&go);
+	for (i = 0; i < SUBMITS; i++) acu_submit_to(acu_new_unique(malloc(1), del_count), hot);
+	acu_return NULL;
+END
+
+/* Hand references to a shared object to SUBMITTERS threads submitting to it at once, and drop the own one */
+static void concurrent_submit(void)
+BEGIN
+	pthread_t tid[SUBMITTERS];
+	long k;
+	acu_unique *u = acu_new_unique(malloc(1), del_count);
+	hot = acu_share(u);
+	pthread_barrier_init(&ready, NULL, SUBMITTERS + 1);
+	pthread_barrier_init(&go, NULL, SUBMITTERS + 1);
+	for (k = 0; k < SUBMITTERS; k++) pthread_create(&tid[k], NULL, submitter, (void *)k);
+	pthread_barrier_wait(&ready);
+	for (k = 0; k < SUBMITTERS; k++) acu_transfer(acu_new_reference(hot), slots[k]);
+	destructed = 0;
+	pthread_barrier_wait(&go);
+	acu_destruct(u);
+	for (k = 0; k < SUBMITTERS; k++) pthread_join(tid[k], NULL);
+	pthread_barrier_destroy(&ready);
+	pthread_barrier_destroy(&go);
+	check(destructed == SUBMITTERS * SUBMITS + 1, "objects submitted by several threads destructed once");
+END
+#endif
+
+int main(void)
+BEGIN
+	submit_and_drop();
+	#ifdef ACU_THREAD_SAFE
+		concurrent_submit();
+	#endif
+
+	BEGIN_SCOPE
+		acu_shared *s = acu_share(obj("s"));
+		submit_three(s);
+		(void)obj("x");
+	END_SCOPE
+	check_log("xcbas", "submitted objects left to the end of the scope");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include "../autocleanup.h"
+#include "../exception.h"
+#include "../exc_classes.h"
+
+/* Test that yielding does not change the order of destruction: objects are destructed in reverse order of their
+ * creation, whether they are yielded newest or oldest first or in mixed order, through one or two levels of
+ * functions, or left behind by an exception. Each object is a one-letter string, and its destructor appends it to a log that is
+ * compared with the expected order.
+ *
+ * Build from the repository root, e.g.
+ *   gcc tests/yield_order_test.c acu_std.c autocleanup.c exc_classes.c exc_std.c exception.c -o yield_order_test
+ * and add -DACU_ARRAY_STACK for the array-backed stack, or e.g. -D_ACU_SEQ_LIMIT=8 to renumber the creation
+ * numbers of the linked stack often. Exits with status 0 and prints "ok" on success. */
+
+static char log_buf[32];
+static int log_len, failures;
+static acu_unique *ya, *yb;
+
+static void del_log(void *p) { log_buf[log_len++] = *(const char *)p; }
+
+static acu_unique *obj(const char *name) { return acu_new_unique((void *)name, del_log); }
+
+static void check_log(const char *expected, const char *what)
+{
+	log_buf[log_len] = '\0';
+	if (strcmp(log_buf, expected))
+	{
+		printf("FAIL: %s: destructed %s, expected %s\n", what, log_buf, expected);
+		failures++;
+	}
+	log_len = 0;
+}
+
+/* Create "a" and "b", yield both in the order given, and leave "x" to be destructed on return */
+static void make_two(int oldest_first, int fail)
+BEGIN
+	ya = obj("a");
+	yb = obj("b");
+	if (oldest_first) { acu_yield(ya); acu_yield(yb); }
+	else { acu_yield(yb); acu_yield(ya); }
+	(void)obj("x");
+	if (fail) throw(new_name_exception("make_two"));
+END
+
+/* Create "a" to "e", yield them in mixed order, and leave "x" to be destructed on return */
+static void make_five(void)
+BEGIN
+	static const int order[] = { 1, 3, 0, 4, 2 };
+	acu_unique *u[5];
+	int i;
+	for (i = 0; i < 5; i++) u[i] = obj("abcde" + i);
+	for (i = 0; i < 5; i++) acu_yield(u[order[i]]);
+	(void)obj("x");
+END
+
+/* Create "m", yield "a" and "b" of make_two further to the caller, and create "n" */
+static void pass_two(int oldest_first)
+BEGIN
+	(void)obj("m");
+	make_two(oldest_first, 0);
+	if (oldest_first) { acu_yield(ya); acu_yield(yb); }
+	else { acu_yield(yb); acu_yield(ya); }
+	(void)obj("n");
+END
+
+int main(void)
+BEGIN
+	int oldest_first;
+	for (oldest_first = 0; oldest_first < 2; oldest_first++)
+	{
+		BEGIN_SCOPE
+			(void)obj("c");
+			make_two(oldest_first, 0);
+			check_log("x", "make_two returns");
+			(void)obj("d");
+		END_SCOPE
+		check_log("dbac", "yield through one level");
+
+		BEGIN_SCOPE
+			(void)obj("c");
+			pass_two(oldest_first);
+			check_log("xnm", "pass_two returns");
+			(void)obj("d");
+		END_SCOPE
+		check_log("dbac", "yield through two levels");
+
+		BEGIN_SCOPE
+			(void)obj("c");
+			TRY
+				make_two(oldest_first, 1);
+			CATCH(ex)
+				(void)ex;
+			TRY_END
+			check_log("xba", "exception after yield");
+			(void)obj("d");
+		END_SCOPE
+		check_log("dc", "scope after exception");
+	}
+
+	BEGIN_SCOPE
+		(void)obj("y");
+		make_five();
+		check_log("x", "make_five returns");
+		(void)obj("z");
+	END_SCOPE
+	check_log("zedcbay", "yield in mixed order");
+
+	if (failures) acu_return 1;
+	printf("ok\n");
+	acu_return 0;
+END